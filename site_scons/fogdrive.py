@@ -19,10 +19,11 @@
 import os
 
 class FogDrive(object):
-    def __init__(self, mcu, frequency, fog_drive_name):
+    def __init__(self, mcu, frequency, fog_drive_name, fast_fire = False):
         self.mcu = mcu
         self.frequency = frequency
         self.fog_drive_name = fog_drive_name
+        self.fast_fire = fast_fire
         
     @property
     def src_directory(self):
@@ -47,17 +48,32 @@ class FogDrive(object):
         """
         File system representation name of the variant, used for the build directory.
         """
-        return "{mcu}_{f}".format(mcu = self.mcu, f = str(self.frequency)[0:4])
+        name = "{mcu}_{f}".format(mcu = self.mcu, f = str(self.frequency)[0:4])
+        if self.fast_fire:
+            name += "_ff"
+        return name
     
     @property
     def cpp_defines(self):
         """
         C pre processor defines as a dict (name -> value) that are injected from the gcc to the sources.
         """
-        return {
+        defines = {
             'F_CPU' : "{f}UL".format(f = self.frequency),
-            'MCUHEADER' : "\\\"../../mcus/{mcu}.h\\\"".format(mcu = self.mcu)
+            # (found via cpp_path, the header is in the source directory of the mcus)
+            'MCUHEADER' : "\\\"{mcu}.h\\\"".format(mcu = self.mcu)
         }
+        if self.fast_fire:
+            # fire as soon as the fire button is pressed, see ui.c
+            defines['UI_FAST_FIRE'] = 1
+        return defines
+    
+    @property
+    def cpp_path(self):
+        """
+        Include directories as a list (the MCU header, see cpp_defines), independent of the variant build directories.
+        """
+        return [os.path.join('#', 'source', 'mcus')]
     
     @property
     def cc_flags(self):
@@ -75,5 +91,5 @@ class FogDrive(object):
         ]
     
 class Mira(FogDrive):
-    def __init__(self, mcu, frequency):
-        FogDrive.__init__(self, mcu, frequency, "mira")
\ No newline at end of file
+    def __init__(self, mcu, frequency, fast_fire = False):
+        FogDrive.__init__(self, mcu, frequency, "mira", fast_fire)
\ No newline at end of file
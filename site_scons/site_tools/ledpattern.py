@@ -0,0 +1,211 @@
+###############################################################################
+# FogDrive (https://github.com/FogDrive/FogDrive)
+# Copyright (C) 2016  Daniel Llin Ferrero
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+###############################################################################
+
+"""
+The LED pattern compiler as SCons tool.
+It adds the builder "LedPatterns" that compiles a pattern description (.ledpat) into a C header with one PROGMEM
+byte code array per pattern, executed by the LED module (see led.h):
+
+    env.LedPatterns('ui_patterns.h', 'ui_patterns.ledpat')
+
+A pattern description holds any number of patterns, one instruction per line ('#' starts a comment):
+
+    pattern <name>                      starts the pattern, the C array is named led_pattern_<name>
+    <label>:                            marks the position of the next instruction for a repeat
+    set <brightness>                    sets the brightness (0..99) at once
+    dim <brightness> <ticks>            dims linearly to the brightness within the ticks (10 ms each)
+    hold <ticks>                        keeps the brightness (1..255 ticks)
+    repeat <label> <count>              runs the instructions from the label count times in total; the count is
+                                        a number (1..255), a parameter (p0, p1) or "forever"
+    stop_if_zero <p0|p1>                ends the pattern if the parameter is 0
+    callback                            calls the callback given to led_start_pattern()
+
+The parameters p0 and p1 are passed to led_start_pattern(). The header can also be created without SCons:
+
+    python ledpattern.py ui_patterns.ledpat ui_patterns.h
+"""
+
+import os
+import re
+import sys
+
+# Length of the instructions in bytes, must match the LED_* macros in led.h
+INSTRUCTION_LENGTH = {
+    'set': 2,
+    'dim': 3,
+    'hold': 2,
+    'repeat': 4,
+    'stop_if_zero': 2,
+    'callback': 1,
+    'end': 1,
+}
+# Number of repeat counters and parameters of the LED module (LED_PATTERN_LOOPS, LED_PATTERN_PARAMS in led.h)
+LOOPS = 2
+PARAMS = 2
+
+class PatternError(Exception):
+    pass
+
+def _number(word, lowest, highest, line_number):
+    try:
+        value = int(word, 0)
+    except ValueError:
+        raise PatternError("line {l}: '{w}' is not a number".format(l = line_number, w = word))
+    if value < lowest or value > highest:
+        raise PatternError("line {l}: {v} is not within {lo}..{hi}".format(l = line_number, v = value, lo = lowest, hi = highest))
+    return value
+
+def _param(word, line_number):
+    match = re.match(r'^p(\d)$', word)
+    if not match or int(match.group(1)) >= PARAMS:
+        raise PatternError("line {l}: '{w}' is not a parameter (p0..p{n})".format(l = line_number, w = word, n = PARAMS - 1))
+    return int(match.group(1))
+
+class Pattern(object):
+    def __init__(self, name):
+        self.name = name
+        self.instructions = []      # (line number, words, offset)
+        self.labels = {}            # label -> offset
+        self.size = 0
+
+    def add(self, words, line_number):
+        if words[0] not in INSTRUCTION_LENGTH or words[0] == 'end':
+            raise PatternError("line {l}: unknown instruction '{i}'".format(l = line_number, i = words[0]))
+        self.instructions.append((line_number, words, self.size))
+        self.size += INSTRUCTION_LENGTH[words[0]]
+
+    def to_c(self):
+        lines = []
+        loops = 0
+        for (line_number, words, offset) in self.instructions + [(0, ['end'], self.size)]:
+            instruction = words[0]
+            arguments = words[1:]
+            expected = {'set': 1, 'dim': 2, 'hold': 1, 'repeat': 2, 'stop_if_zero': 1, 'callback': 0, 'end': 0}[instruction]
+            if len(arguments) != expected:
+                raise PatternError("line {l}: '{i}' takes {n} arguments".format(l = line_number, i = instruction, n = expected))
+            if instruction == 'set':
+                lines.append("LED_SET({b})".format(b = _number(arguments[0], 0, 99, line_number)))
+            elif instruction == 'dim':
+                lines.append("LED_DIM({b}, {t})".format(
+                    b = _number(arguments[0], 0, 99, line_number), t = _number(arguments[1], 0, 255, line_number)))
+            elif instruction == 'hold':
+                lines.append("LED_HOLD({t})".format(t = _number(arguments[0], 1, 255, line_number)))
+            elif instruction == 'repeat':
+                if arguments[0] not in self.labels:
+                    raise PatternError("line {l}: unknown label '{a}'".format(l = line_number, a = arguments[0]))
+                target = self.labels[arguments[0]]
+                if target > offset:
+                    raise PatternError("line {l}: repeat can only jump back".format(l = line_number))
+                if loops == LOOPS:
+                    raise PatternError("line {l}: more than {n} repeats in pattern {p}".format(l = line_number, n = LOOPS, p = self.name))
+                if arguments[1] == 'forever':
+                    lines.append("LED_REPEAT({t}, {s}, 0)".format(t = target, s = loops))
+                elif arguments[1].startswith('p'):
+                    lines.append("LED_REPEAT_PARAM({t}, {s}, {p})".format(t = target, s = loops, p = _param(arguments[1], line_number)))
+                else:
+                    lines.append("LED_REPEAT({t}, {s}, {c})".format(t = target, s = loops, c = _number(arguments[1], 1, 255, line_number)))
+                loops += 1
+            elif instruction == 'stop_if_zero':
+                lines.append("LED_STOP_IF_ZERO({p})".format(p = _param(arguments[0], line_number)))
+            elif instruction == 'callback':
+                lines.append("LED_CALLBACK")
+            else:
+                lines.append("LED_END")
+        if self.size + 1 > 255:
+            raise PatternError("pattern {p} is longer than 255 bytes".format(p = self.name))
+        return "static const uint8_t led_pattern_{n}[] PROGMEM = {{     // {s} bytes\n    {i}\n}};\n".format(
+            n = self.name, s = self.size + 1, i = ",\n    ".join(lines))
+
+def compile_patterns(text, source_name, header_name):
+    """
+    Returns the C header for the pattern description text.
+    """
+    patterns = []
+    pattern = None
+    for line_number, line in enumerate(text.splitlines(), 1):
+        words = line.split('#', 1)[0].split()
+        if not words:
+            continue
+        if words[0] == 'pattern':
+            if len(words) != 2 or not re.match(r'^[a-z_][a-z0-9_]*$', words[1]):
+                raise PatternError("line {l}: 'pattern' takes a name (a C identifier in lower case)".format(l = line_number))
+            if words[1] in [p.name for p in patterns]:
+                raise PatternError("line {l}: pattern {p} defined twice".format(l = line_number, p = words[1]))
+            pattern = Pattern(words[1])
+            patterns.append(pattern)
+        elif pattern is None:
+            raise PatternError("line {l}: instruction outside of a pattern".format(l = line_number))
+        elif len(words) == 1 and words[0].endswith(':'):
+            pattern.labels[words[0][:-1]] = pattern.size
+        else:
+            pattern.add(words, line_number)
+    guard = re.sub(r'[^A-Z0-9]', '_', os.path.basename(header_name).upper())
+    return "\n".join([
+        "// created by the LED pattern compiler (site_scons/site_tools/ledpattern.py) from {s}, do not edit".format(
+            s = os.path.basename(source_name)),
+        "#ifndef {g}".format(g = guard),
+        "#define {g}".format(g = guard),
+        "",
+        "#include <avr/pgmspace.h>",
+        "#include \"led.h\"",
+        "",
+    ] + [p.to_c() for p in patterns] + [
+        "#endif // {g}".format(g = guard),
+        "",
+    ])
+
+def _build(target, source, env):
+    with open(str(source[0])) as f:
+        text = f.read()
+    try:
+        header = compile_patterns(text, str(source[0]), str(target[0]))
+    except PatternError as e:
+        import SCons.Errors
+        raise SCons.Errors.StopError("{s}: {e}".format(s = source[0], e = e))
+    with open(str(target[0]), 'w') as f:
+        f.write(header)
+    return None
+
+def exists(env):
+    return True
+
+def generate(env):
+    """Add the LedPatterns builder to an Environment."""
+    import SCons.Action
+    import SCons.Builder
+    env.Append(BUILDERS = {
+        'LedPatterns': SCons.Builder.Builder(
+            action = SCons.Action.Action(_build, "Compiling LED patterns $TARGET"),
+            suffix = '.h',
+            src_suffix = '.ledpat',
+        ),
+    })
+
+if __name__ == '__main__':
+    if len(sys.argv) != 3:
+        sys.stderr.write("usage: ledpattern.py <patterns.ledpat> <header.h>\n")
+        sys.exit(2)
+    with open(sys.argv[1]) as f:
+        text = f.read()
+    try:
+        header = compile_patterns(text, sys.argv[1], sys.argv[2])
+    except PatternError as e:
+        sys.stderr.write("{s}: {e}\n".format(s = sys.argv[1], e = e))
+        sys.exit(1)
+    with open(sys.argv[2], 'w') as f:
+        f.write(header)
@@ -19,6 +19,7 @@
 #include "atmega328p.h"
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <util/atomic.h>
 
 
 // Baud rate related calculation
@@ -38,21 +39,74 @@ void uart_init_8_plus_1(void) {
 }
 
 void ui_timer_init_10ms_overflow(void) {
-    TCCR2B = (1<<CS22)|(1<<CS21);  // prescaler 256
-    TIMSK2 = (1<<TOIE2);
-    HWMAP_UI_TIMER_CMD_REINIT_FOR_10ms;
+    TIMSK0 = (1<<TOIE0);                              // timer 0 is started by the LED PWM init
+}
+
+void mcu_stop_ui_timer_till_pin_change(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PCMSK0 |= (1 << PCINT3);                // activate the PCINT for the button pin...
+        PCICR |= (1 << PCIE0);                  // ...and enable the pin change interrupt on PCINT[7..0]
+        TIMSK0 &= ~(1<<TOIE0);
+    }
+}
+
+void mcu_restart_ui_timer(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        PCICR &= ~(1 << PCIE0);
+        TIFR0 = (1<<TOV0);                      // drop an overflow from the time it was stopped
+        TIMSK0 |= (1<<TOIE0);
+    }
+}
+
+void mcu_init_free_running_timer(void) {
+    TCCR1A = 0;                                       // normal mode, no output pins
+    TCCR1B = (1<<CS11);                               // prescaler 8
+}
+
+uint16_t mcu_read_free_running_timer(void) {
+    uint16_t value;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        value = MCU_FREE_RUNNING_TIMER;
+    }
+    return value;
 }
 
 void mcu_init_ui_double_compare_timer_for_fast_pwm_1ms(void) {
     //TODO: it's only 1ms with 1MHz frequency: refactor name or function
-    DDRD |= (1<<6);                                   // Set the pin of PWM channel A as output
-    TCCR0A = (1<<WGM01) | (1<<WGM00) | (1<<COM0A1) | (1<<COM0A0);   // Fast PWM, single slope, count from 0 to 255 (not only till compare), inverting
-    TCCR0B = (1<<CS00);                               // Internal clock, no prescaling
+    DDRD |= (1<<6) | (1<<5);                          // Set the pins of PWM channel A and B as output
+    TCCR0A = (1<<WGM01) | (1<<WGM00) | (1<<COM0A1) | (1<<COM0A0) | (1<<COM0B1) | (1<<COM0B0);   // Fast PWM, single slope, count from 0 to 255 (not only till compare), inverting
+    TCCR0B = (1<<CS01);                               // Internal clock, prescaler 8 (for the UI timer overflow)
+}
+
+void mcu_init_fire_pwm(void) {
+    HWMAP_HW_FIRE_PORT &= ~(1<<HWMAP_HW_FIRE_BIT_IX);  // fire off
+    HWMAP_HW_FIRE_DDR |= (1<<HWMAP_HW_FIRE_BIT_IX);    // fire pin as output
+    OCR2A = MCU_FIRE_PWM_STEPS - 1;                   // TOP
+    TCCR2A = (1<<WGM21) | (1<<WGM20);                 // Fast PWM with OCR2A as TOP (mode 7), OC2B disconnected
+    TCCR2B = (1<<WGM22);                              // timer stopped
+}
+
+void mcu_set_fire_pwm(uint8_t duty) {
+    if (duty == 0 || duty >= MCU_FIRE_PWM_STEPS) {
+        // off or permanently on: the pin is driven by the port, the timer is stopped
+        if (duty == 0) {
+            HWMAP_HW_FIRE_PORT &= ~(1<<HWMAP_HW_FIRE_BIT_IX);
+        } else {
+            HWMAP_HW_FIRE_PORT |= (1<<HWMAP_HW_FIRE_BIT_IX);
+        }
+        TCCR2A &= ~(1<<COM2B1);                       // OC2B disconnected
+        TCCR2B = (1<<WGM22);
+    } else {
+        OCR2B = duty - 1;                             // (double buffered, takes effect with the next period)
+        TCCR2B = (1<<WGM22) | (1<<CS20);              // no prescaling
+        TCCR2A |= (1<<COM2B1);                        // OC2B set at BOTTOM, cleared on compare match
+    }
 }
 
 void mcu__enabled_one_adc_with_vcc_reference_and_vgb_input(void) {
     ADMUX |= (1<<REFS0);                         //voltage reference selction: AV_CC
     ADMUX |= (1<<MUX3) | (1<<MUX2) | (1<<MUX1);  //input voltage selection: 1.1V (V_BG)
+    ADCSRA |= (1<<ADPS1) | (1<<ADPS0);           //ADC clock F_CPU / 8 (125 kHz at 1 MHz, 50..200 kHz for full resolution)
     ADCSRA |= (1<<ADEN);                         //activate ADC
 }
 
@@ -64,7 +118,24 @@ void mcu_power_down_till_pin_change(void) {
     PCICR &= ~(1 << PCIE0);                     // we're waking up! disable pin change iterrupt on PCINT[7..0]
 }
 
+void mcu_idle_till_interrupt(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);            // timers, ADC and UART keep on running
+    sleep_enable();
+    sei();                                      // the instruction after sei is executed before any pending interrupt,
+    sleep_cpu();                                // so an interrupt can't sneak in between checking for work and sleeping
+    sleep_disable();
+}
+
+void mcu_adc_noise_reduction_till_interrupt(void) {
+    set_sleep_mode(SLEEP_MODE_ADC);             // only the ADC (and asynchronous sources) keep on running
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
 ISR(PCINT0_vect) {
     // Nothing to do in this interrupt routine.
-    // It must just be defined since we need that interrupt to awake from "power down" sleep mode.
+    // It must just be defined since we need that interrupt to awake from "power down" sleep mode (and from idle
+    // while the UI timer is stopped).
 }
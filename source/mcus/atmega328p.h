@@ -35,19 +35,31 @@
 #define HWMAP_UI_OUTPIN_DDR     DDRB
 #define HWMAP_UI_OUTPIN_PORT    PORTB
 #define HWMAP_UI_OUTPIN_0_IX    2
+// Output pin 0 drives the optional third LED (the coil faults); both compare channels of timer 0 drive the main and
+// the status LED, so it's dimmed by software PWM from the UI timer overflow
+#define HWMAP_UI_SOFT_PWM_LED_IX HWMAP_UI_OUTPIN_0_IX
 
 /**************************************************
  * UI timer for event timing
  *************************************************/
-#define HWMAP_UI_TIMER_ISR     TIMER2_OVF_vect
-#define HWMAP_UI_TIMER_CMD_REINIT_FOR_10ms TCNT2 = (256-(F_CPU / 256 * 10e-3 + 0.5));
-// Function that initializes the UI timers and PWMs
+// Timer 0 (the LED PWM timer) overflows each 256 * 8 / F_CPU s (2 ms at 1 MHz)
+#define HWMAP_UI_TIMER_ISR     TIMER0_OVF_vect
+// Number of overflows per UI tick (about 10 ms at 1 MHz)
+#define HWMAP_UI_TIMER_OVERFLOWS_PER_TICK ((uint8_t) (F_CPU / (256 * 8) * 10e-3 + 0.5))
+// Function that enables the overflow interrupt of the UI timer
 void ui_timer_init_10ms_overflow(void);
+// Functions that stop the overflow interrupt of the UI timer (the timer keeps on running for the PWM) with the
+// pin change interrupt of the button enabled instead (it just wakes up the main loop), and restart it
+void mcu_stop_ui_timer_till_pin_change(void);
+void mcu_restart_ui_timer(void);
 
 /**************************************************
  * UI timer for LED PWM
  *************************************************/
+// Compare registers of the LED channels: A on OC0A (PD6) for the main LED, B on OC0B (PD5) for the status LED
 #define MCU_UI_PWM_A_CR OCR0A
+#define MCU_UI_PWM_B_CR OCR0B
+// Function that starts timer 0 as fast PWM (prescaler 8) on both channels for the LEDs, it's the UI timer as well
 void mcu_init_ui_double_compare_timer_for_fast_pwm_1ms(void);
 
 /**************************************************
@@ -63,27 +75,92 @@ void mcu_init_ui_double_compare_timer_for_fast_pwm_1ms(void);
 // Function that inititializes the UART with 8 data and one stop bit.
 void uart_init_8_plus_1(void);
 
+/**************************************************
+ * Free running timer (for time measurements during development)
+ *************************************************/
+// The free running 16 bit timer register (use mcu_read_free_running_timer() outside of ISRs)
+#define MCU_FREE_RUNNING_TIMER  TCNT1
+// Number of CPU cycles per timer tick
+#define MCU_FREE_RUNNING_TIMER_PRESCALER 8
+// Function that starts timer 1 as free running timer, counting with F_CPU / MCU_FREE_RUNNING_TIMER_PRESCALER
+void mcu_init_free_running_timer(void);
+// Function that reads the free running timer atomically (the 16 bit read must not be interrupted by an ISR reading it as well)
+uint16_t mcu_read_free_running_timer(void);
+
 /**************************************************
  * Hardware fire pin
  *************************************************/
 // Data register used to control the fire MOSFET
-#define HWMAP_HW_FIRE_DDR        DDRB
+#define HWMAP_HW_FIRE_DDR        DDRD
 // Corresponding port
-#define HWMAP_HW_FIRE_PORT       PORTB
-// Index of the pin used to control the fire MOSFET
-#define HWMAP_HW_FIRE_BIT_IX     0
+#define HWMAP_HW_FIRE_PORT       PORTD
+// Index of the pin used to control the fire MOSFET (OC2B, the output of the fire PWM)
+#define HWMAP_HW_FIRE_BIT_IX     3
+
+/**************************************************
+ * Hardware fire PWM (timer 2, fast PWM with OCR2A as TOP)
+ *************************************************/
+// Number of PWM steps per period, the duty cycle is given in steps (0: off, MCU_FIRE_PWM_STEPS: permanently on)
+#define MCU_FIRE_PWM_STEPS       40
+// PWM frequency in Hz (25 kHz at 1 MHz, above the audible range)
+#define MCU_FIRE_PWM_FREQUENCY   (F_CPU / MCU_FIRE_PWM_STEPS)
+// Function that configures the fire pin and the PWM timer (fire off)
+void mcu_init_fire_pwm(void);
+// Function that sets the duty cycle of the fire pin; the timer only runs for 0 < duty < MCU_FIRE_PWM_STEPS
+void mcu_set_fire_pwm(uint8_t duty);
+
+/**************************************************
+ * Hardware fire timeout (compare channel A of timer 1, the free running timer)
+ *************************************************/
+#define MCU_FIRE_TIMEOUT_ISR      TIMER1_COMPA_vect
+// The compare register applies at once (normal mode), the 16 bit timer wraps each 65536 ticks (524 ms at 1 MHz)
+#define MCU_FIRE_TIMEOUT_OCR      OCR1A
+#define MCU_FIRE_TIMEOUT_TIMER    TCNT1
+#define MCU_FIRE_TIMEOUT_TIMER_BITS 16
+// Timer ticks per ms (prescaler 8)
+#define MCU_FIRE_TIMEOUT_TICKS_PER_MS (F_CPU / MCU_FREE_RUNNING_TIMER_PRESCALER / 1000)
+#define MCU__CLEAR_FIRE_TIMEOUT_FLAG        TIFR1 = (1<<OCF1A)
+#define MCU__ENABLE_FIRE_TIMEOUT_INTERRUPT  TIMSK1 |= (1<<OCIE1A)
+#define MCU__DISABLE_FIRE_TIMEOUT_INTERRUPT TIMSK1 &= ~(1<<OCIE1A)
 
 /**************************************************
  * Hardware ADC
  *************************************************/
 void mcu__enabled_one_adc_with_vcc_reference_and_vgb_input(void);
 #define MCU__START_SINGLE_ADC_CONVERSION ADCSRA |= (1<<ADSC)
-#define MCU__SINGLE_ADC_CONVERSION_IS_DONE ! (ADCSRA & (1<<ADSC))
+// The ADC conversion complete interrupt (enabled by MCU__ENABLE_ADC_INTERRUPT)
+#define MCU_ADC_ISR ADC_vect
+#define MCU__ENABLE_ADC_INTERRUPT ADCSRA |= (1<<ADIE)
+#define MCU__DISABLE_ADC_INTERRUPT ADCSRA &= ~(1<<ADIE)
+// The 10 bit result of the last conversion
+#define MCU__ADC_RESULT ADC
+// A conversion is running or its interrupt is pending (so starting another one would mix up the results)
+#define MCU__ADC_BUSY (ADCSRA & ((1<<ADSC) | (1<<ADIF)))
+// Input selection (the reference is selected separately): the band gap for the battery voltage or the coil current sense,
+// ADC0 on PC0: the voltage over the shunt between the source of the fire MOSFET and ground
+#define MCU__SELECT_ADC_BANDGAP_INPUT ADMUX = (ADMUX & 0xF0) | (1<<MUX3) | (1<<MUX2) | (1<<MUX1)
+#define MCU__SELECT_ADC_COIL_SENSE_INPUT ADMUX = (ADMUX & 0xF0) | 0
+// Reference selection: V_CC (AV_CC, the battery voltage) or the internal 1.1 V reference. The AREF pin follows the
+// reference: its capacitor (10 nF on the board) is recharged by the internal reference (about 32 kOhm), so the
+// conversions of the first 3 ms after switching to it are discarded (at F_CPU / 8, 13 ADC clocks each); AV_CC
+// drives it back at once.
+#define MCU__SELECT_ADC_VCC_REFERENCE ADMUX = (ADMUX & ~(1<<REFS1)) | (1<<REFS0)
+#define MCU__SELECT_ADC_INTERNAL_REFERENCE ADMUX |= (1<<REFS1) | (1<<REFS0)
+#define MCU_ADC_REFERENCE_SETTLE_CONVERSIONS ((uint8_t) (3e-3 * F_CPU / (13 * 8) + 1))
+// ADC clock F_CPU / 8 (full resolution) or F_CPU / 2 (about 8 bit, a conversion takes 26 us at 1 MHz)
+// (ADIF is written as 0, a 1 would clear a pending interrupt)
+#define MCU__SET_ADC_CLOCK_PRECISE ADCSRA = (ADCSRA & ~((1<<ADIF) | (1<<ADPS2))) | (1<<ADPS1) | (1<<ADPS0)
+#define MCU__SET_ADC_CLOCK_FAST ADCSRA = (ADCSRA & ~((1<<ADIF) | (1<<ADPS2) | (1<<ADPS1))) | (1<<ADPS0)
 
 /**************************************************
  * Power Down
  *************************************************/
 void mcu_power_down_till_pin_change(void);
+// Function that must be called with disabled interrupts; it enables them and sleeps (idle mode) till the next interrupt
+void mcu_idle_till_interrupt(void);
+// Same as mcu_idle_till_interrupt(), but in ADC noise reduction mode: the I/O clock is stopped (timers, PWMs
+// and the UART pause), so the running conversion is not disturbed; it ends with the ADC interrupt at the latest
+void mcu_adc_noise_reduction_till_interrupt(void);
 
 #endif // ATMEGA328P_H
 
@@ -19,27 +19,76 @@
 #include "attiny45.h"
 #include <avr/interrupt.h>
 #include <avr/sleep.h>
+#include <util/atomic.h>
+#include <util/delay.h>
 
 void uart_init_8_plus_1(void) {
     // No UART for the Tiny
 }
 
 void ui_timer_init_10ms_overflow(void) {
-    TCCR1 = (1<<CS10)|(1<<CS13);  // prescaler 256
-    TIMSK = (1<<TOIE1);  // enable overflow interrupt
-    HWMAP_UI_TIMER_CMD_REINIT_FOR_10ms;
+    TIMSK |= (1<<TOIE0);  // enable overflow interrupt (timer 0 is started by the LED PWM init)
+}
+
+void mcu_stop_ui_timer_till_pin_change(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {         // (the fire timeout ISR modifies the interrupt mask as well)
+        PCMSK |= (1 << PCINT2);                 // activate the PCINT for the button pin...
+        GIMSK |= (1 << PCIE);                   // ...and enable the pin change interrupt on PCINT[7..0]
+        TIMSK &= ~(1<<TOIE0);
+    }
+}
+
+void mcu_restart_ui_timer(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        GIMSK &= ~(1 << PCIE);
+        TIFR = (1<<TOV0);                       // drop an overflow from the time it was stopped
+        TIMSK |= (1<<TOIE0);
+    }
 }
 
 void mcu_init_ui_double_compare_timer_for_fast_pwm_1ms(void) {
     //TODO: it's only 1ms with 1MHz frequency: refactor name or function
     DDRB |= (1<<1);                                   // Set the pin of PWM channel B as output
     TCCR0A = (1<<WGM01) | (1<<WGM00) | (1<<COM0B1) | (1<<COM0B0);   // Fast PWM, single slope, count from 0 to 255 (not only till compare), inverting
-    TCCR0B = (1<<CS00);                               // Internal clock, no prescaling
+    TCCR0B = (1<<CS01);                               // Internal clock, prescaler 8 (for the UI timer overflow)
+}
+
+void mcu_init_fire_pwm(void) {
+    HWMAP_HW_FIRE_PORT &= ~(1<<HWMAP_HW_FIRE_BIT_IX);  // fire off
+    HWMAP_HW_FIRE_DDR |= (1<<HWMAP_HW_FIRE_BIT_IX);    // fire pin as output (OC1B on PB4 stays an input)
+    OCR1C = MCU_FIRE_PWM_STEPS - 1;                   // TOP
+    TCCR1 = 0;                                        // timer stopped
+    GTCCR &= ~((1<<PWM1B) | (1<<COM1B1) | (1<<COM1B0));
+}
+
+void mcu_set_fire_pwm(uint8_t duty) {
+    if (duty == 0 || duty >= MCU_FIRE_PWM_STEPS) {
+        // off or permanently on: the pin is driven by the port, timer and PLL are stopped (the PLL draws some mA)
+        if (duty == 0) {
+            HWMAP_HW_FIRE_PORT &= ~(1<<HWMAP_HW_FIRE_BIT_IX);
+        } else {
+            HWMAP_HW_FIRE_PORT |= (1<<HWMAP_HW_FIRE_BIT_IX);
+        }
+        GTCCR &= ~((1<<PWM1B) | (1<<COM1B1) | (1<<COM1B0));
+        TCCR1 = 0;
+        PLLCSR = 0;
+    } else {
+        if (!(PLLCSR & (1<<PCKE))) {
+            PLLCSR = (1<<PLLE);                       // start the PLL...
+            _delay_us(100);                           // ...which needs some time before it can lock
+            while (!(PLLCSR & (1<<PLOCK)));
+            PLLCSR |= (1<<PCKE);                      // timer 1 clocked by the PLL (64 MHz)
+            TCCR1 = (1<<CS12) | (1<<CS11) | (1<<CS10); // prescaler 64
+        }
+        OCR1B = MCU_FIRE_PWM_STEPS - duty;            // ~OC1B is high from the compare match till the end of the period
+        GTCCR |= (1<<PWM1B) | (1<<COM1B0);            // PWM on OCR1B, ~OC1B connected
+    }
 }
 
 void mcu__enabled_one_adc_with_vcc_reference_and_vgb_input(void) {
     // REFS0+REFS1 left to 00 in order to use AV_CC as reference
     ADMUX |= (1<<MUX3) | (1<<MUX2);  //input voltage selection: 1.1V (V_BG)
+    ADCSRA |= (1<<ADPS1) | (1<<ADPS0);           //ADC clock F_CPU / 8 (125 kHz at 1 MHz, 50..200 kHz for full resolution)
     ADCSRA |= (1<<ADEN);                         //activate ADC
 }
 
@@ -51,7 +100,24 @@ void mcu_power_down_till_pin_change(void) {
     GIMSK &= ~(1 << PCIE);                     // we're waking up! disable pin change iterrupt on PCINT[7..0]
 }
 
+void mcu_idle_till_interrupt(void) {
+    set_sleep_mode(SLEEP_MODE_IDLE);            // timers, ADC and UART keep on running
+    sleep_enable();
+    sei();                                      // the instruction after sei is executed before any pending interrupt,
+    sleep_cpu();                                // so an interrupt can't sneak in between checking for work and sleeping
+    sleep_disable();
+}
+
+void mcu_adc_noise_reduction_till_interrupt(void) {
+    set_sleep_mode(SLEEP_MODE_ADC);             // only the ADC (and asynchronous sources) keep on running
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+}
+
 ISR(PCINT0_vect) {
     // Nothing to do in this interrupt routine.
-    // It must just be defined since we need that interrupt to awake from "power down" sleep mode.
+    // It must just be defined since we need that interrupt to awake from "power down" sleep mode (and from idle
+    // while the UI timer is stopped).
 }
@@ -39,11 +39,18 @@
 /**************************************************
  * UI timer
  *************************************************/
-#define HWMAP_UI_TIMER_ISR     TIMER1_OVF_vect
-#define HWMAP_UI_TIMER_CMD_REINIT_FOR_10ms TCNT1 = (256-(F_CPU / 256 * 10e-3 + 0.5));
+// Timer 0 (the LED PWM timer) overflows each 256 * 8 / F_CPU s (2 ms at 1 MHz)
+#define HWMAP_UI_TIMER_ISR     TIMER0_OVF_vect
+// Number of overflows per UI tick (about 10 ms at 1 MHz)
+#define HWMAP_UI_TIMER_OVERFLOWS_PER_TICK ((uint8_t) (F_CPU / (256 * 8) * 10e-3 + 0.5))
 #define MCU_UI_PWM_A_CR OCR0B
-// Function that initializes the UI timers and PWMs
+// Function that enables the overflow interrupt of the UI timer
 void ui_timer_init_10ms_overflow(void);
+// Functions that stop the overflow interrupt of the UI timer (the timer keeps on running for the PWM) with the
+// pin change interrupt of the button enabled instead (it just wakes up the main loop), and restart it
+void mcu_stop_ui_timer_till_pin_change(void);
+void mcu_restart_ui_timer(void);
+// Function that starts timer 0 as fast PWM (prescaler 8) for the LED, it's the UI timer as well
 void mcu_init_ui_double_compare_timer_for_fast_pwm_1ms(void);
 
 /**************************************************
@@ -59,20 +66,73 @@ void uart_init_8_plus_1(void);
 #define HWMAP_HW_FIRE_DDR        DDRB
 // Corresponding port
 #define HWMAP_HW_FIRE_PORT       PORTB
-// Index of the pin used to control the fire MOSFET
+// Index of the pin used to control the fire MOSFET (~OC1B, the inverted output of the fire PWM)
 #define HWMAP_HW_FIRE_BIT_IX     3
 
+/**************************************************
+ * Hardware fire PWM (timer 1, clocked by the 64 MHz PLL)
+ *************************************************/
+// Number of PWM steps per period, the duty cycle is given in steps (0: off, MCU_FIRE_PWM_STEPS: permanently on)
+#define MCU_FIRE_PWM_STEPS       40
+// PWM frequency in Hz (the PLL clock divided by 64, independent of F_CPU)
+#define MCU_FIRE_PWM_FREQUENCY   (64000000UL / 64 / MCU_FIRE_PWM_STEPS)
+// Function that configures the fire pin and the PWM timer (fire off)
+void mcu_init_fire_pwm(void);
+// Function that sets the duty cycle of the fire pin; the PLL and the timer only run for 0 < duty < MCU_FIRE_PWM_STEPS
+void mcu_set_fire_pwm(uint8_t duty);
+
+/**************************************************
+ * Hardware fire timeout (compare channel A of timer 0, the UI timer; channel B is the LED PWM)
+ *************************************************/
+#define MCU_FIRE_TIMEOUT_ISR      TIMER0_COMPA_vect
+// The compare register is double buffered (fast PWM), a new value applies from the next overflow on
+#define MCU_FIRE_TIMEOUT_OCR      OCR0A
+#define MCU_FIRE_TIMEOUT_TIMER    TCNT0
+#define MCU_FIRE_TIMEOUT_TIMER_BITS 8
+#define MCU_FIRE_TIMEOUT_OCR_DOUBLE_BUFFERED
+// Timer ticks per ms (prescaler 8)
+#define MCU_FIRE_TIMEOUT_TICKS_PER_MS (F_CPU / 8 / 1000)
+#define MCU__CLEAR_FIRE_TIMEOUT_FLAG        TIFR = (1<<OCF0A)
+#define MCU__FIRE_TIMEOUT_FLAG_IS_SET       (TIFR & (1<<OCF0A))
+#define MCU__ENABLE_FIRE_TIMEOUT_INTERRUPT  TIMSK |= (1<<OCIE0A)
+#define MCU__DISABLE_FIRE_TIMEOUT_INTERRUPT TIMSK &= ~(1<<OCIE0A)
+
 /**************************************************
  * Hardware ADC
  *************************************************/
 void mcu__enabled_one_adc_with_vcc_reference_and_vgb_input(void);
 #define MCU__START_SINGLE_ADC_CONVERSION ADCSRA |= (1<<ADSC)
-#define MCU__SINGLE_ADC_CONVERSION_IS_DONE ! (ADCSRA & (1<<ADSC))
+// The ADC conversion complete interrupt (enabled by MCU__ENABLE_ADC_INTERRUPT)
+#define MCU_ADC_ISR ADC_vect
+#define MCU__ENABLE_ADC_INTERRUPT ADCSRA |= (1<<ADIE)
+#define MCU__DISABLE_ADC_INTERRUPT ADCSRA &= ~(1<<ADIE)
+// The 10 bit result of the last conversion
+#define MCU__ADC_RESULT ADC
+// A conversion is running or its interrupt is pending (so starting another one would mix up the results)
+#define MCU__ADC_BUSY (ADCSRA & ((1<<ADSC) | (1<<ADIF)))
+// Input selection (the reference is selected separately): the band gap for the battery voltage or the coil current sense,
+// ADC2 on PB4: the voltage over the shunt between the source of the fire MOSFET and ground
+#define MCU__SELECT_ADC_BANDGAP_INPUT ADMUX = (ADMUX & 0xF0) | (1<<MUX3) | (1<<MUX2)
+#define MCU__SELECT_ADC_COIL_SENSE_INPUT ADMUX = (ADMUX & 0xF0) | (1<<MUX1)
+// Reference selection: V_CC (the battery voltage) or the internal 1.1 V reference (with AREF on PB0 disconnected,
+// only the first conversion after switching to it is discarded)
+#define MCU__SELECT_ADC_VCC_REFERENCE ADMUX &= ~((1<<REFS2) | (1<<REFS1) | (1<<REFS0))
+#define MCU__SELECT_ADC_INTERNAL_REFERENCE ADMUX = (ADMUX & ~((1<<REFS2) | (1<<REFS0))) | (1<<REFS1)
+#define MCU_ADC_REFERENCE_SETTLE_CONVERSIONS 1
+// ADC clock F_CPU / 8 (full resolution) or F_CPU / 2 (about 8 bit, a conversion takes 26 us at 1 MHz)
+// (ADIF is written as 0, a 1 would clear a pending interrupt)
+#define MCU__SET_ADC_CLOCK_PRECISE ADCSRA = (ADCSRA & ~((1<<ADIF) | (1<<ADPS2))) | (1<<ADPS1) | (1<<ADPS0)
+#define MCU__SET_ADC_CLOCK_FAST ADCSRA = (ADCSRA & ~((1<<ADIF) | (1<<ADPS2) | (1<<ADPS1))) | (1<<ADPS0)
 
 /**************************************************
  * Power Down
  *************************************************/
 void mcu_power_down_till_pin_change(void);
+// Function that must be called with disabled interrupts; it enables them and sleeps (idle mode) till the next interrupt
+void mcu_idle_till_interrupt(void);
+// Same as mcu_idle_till_interrupt(), but in ADC noise reduction mode: the I/O clock is stopped (timers, PWMs
+// and the UART pause), so the running conversion is not disturbed; it ends with the ADC interrupt at the latest
+void mcu_adc_noise_reduction_till_interrupt(void);
 
 #endif // ATMEGA328P_H
 
@@ -0,0 +1,173 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <avr/pgmspace.h>
+#include "battery.h"
+#include "logic.h"
+
+// Rested cell voltage in mV for 0%, 5%, ..., 100% state of charge
+#define SOC_CURVE_SIZE 21
+#define SOC_CURVE_STEP 5
+#if BATTERY_CHEMISTRY == BATTERY_LI_ION
+static const uint16_t soc_curve[SOC_CURVE_SIZE] PROGMEM = {  // created by "soccurve.py -c li-ion -n 21"
+ 3000,  3300,  3450,  3530,  3580,  3620,  3650,  3680,
+ 3710,  3740,  3770,  3800,  3840,  3880,  3920,  3960,
+ 4000,  4040,  4080,  4130,  4200
+};
+#elif BATTERY_CHEMISTRY == BATTERY_IMR
+static const uint16_t soc_curve[SOC_CURVE_SIZE] PROGMEM = {  // created by "soccurve.py -c imr -n 21"
+ 3100,  3400,  3520,  3570,  3620,  3655,  3690,  3720,
+ 3750,  3775,  3800,  3830,  3860,  3890,  3920,  3955,
+ 3990,  4035,  4080,  4140,  4200
+};
+#elif BATTERY_CHEMISTRY == BATTERY_LIFEPO4
+static const uint16_t soc_curve[SOC_CURVE_SIZE] PROGMEM = {  // created by "soccurve.py -c lifepo4 -n 21"
+ 2800,  3000,  3150,  3185,  3220,  3238,  3255,  3265,
+ 3275,  3282,  3290,  3295,  3300,  3305,  3310,  3320,
+ 3330,  3338,  3345,  3360,  3450
+};
+#else
+    #error "unknown BATTERY_CHEMISTRY"
+#endif
+
+// All averages are kept with 4 fractional bits
+#define EMA_FRACTION_BITS 4
+
+static uint16_t rested_voltage = 0;         // last rested voltage in mV
+static uint16_t loaded_voltage = 0;         // last loaded voltage in mV
+static uint16_t sag_ema = 0;                // mV << EMA_FRACTION_BITS
+static uint16_t drain_ema = 0;              // uV/s (no fraction, a few hundred uV/s are typical)
+static uint16_t puff_ema = 0;               // firing units << EMA_FRACTION_BITS
+static uint16_t drain_reference_voltage = 0; // rested voltage at the begin of the current drain period
+static uint16_t drain_units = 0;            // firing units since the begin of the current drain period
+static uint8_t puff_units = 0;              // firing units of the current puff
+static uint16_t load_resistance = BATTERY_DEFAULT_LOAD_RESISTANCE;
+static uint8_t loaded_since_rested = 0;     // 1 if there was a loaded measurement after the last rested one
+
+/**
+ * Moves the average one step towards the sample (the first sample initializes it).
+ */
+static uint16_t _ema(uint16_t average, uint16_t sample) {
+    if (average == 0) {
+        return sample;
+    }
+    return (uint16_t) ((int32_t) average + (((int32_t) sample - (int32_t) average) >> BATTERY_EMA_SHIFT));
+}
+
+void battery_rested_measurement(uint16_t millivolts) {
+    rested_voltage = millivolts;
+    loaded_since_rested = 0;
+    if (drain_reference_voltage == 0) {
+        drain_reference_voltage = millivolts;
+        drain_units = 0;
+    } else if (drain_units >= BATTERY_DRAIN_MIN_FIRE_SECONDS * 1000 / BATTERY_FIRING_UNIT_MS) {
+        uint16_t drop = (drain_reference_voltage > millivolts) ? drain_reference_voltage - millivolts : 0;
+        // uV per s of firing
+        uint32_t drain = (uint32_t) drop * (1000UL * 1000 / BATTERY_FIRING_UNIT_MS) / drain_units;
+        drain_ema = _ema(drain_ema, (drain > 0xFFFE) ? 0xFFFE : (uint16_t) drain);
+        drain_reference_voltage = millivolts;
+        drain_units = 0;
+    }
+}
+
+void battery_loaded_measurement(uint16_t millivolts) {
+    loaded_voltage = millivolts;
+    loaded_since_rested = 1;
+    if (rested_voltage > millivolts) {
+        sag_ema = _ema(sag_ema, (rested_voltage - millivolts) << EMA_FRACTION_BITS);
+    }
+}
+
+void battery_fired(uint8_t units) {
+    drain_units = (drain_units > 0xFFFF - units) ? 0xFFFF : drain_units + units;
+    puff_units = (puff_units > 0xFF - units) ? 0xFF : puff_units + units;
+}
+
+void battery_puff_finished(void) {
+    if (puff_units > 0) {
+        puff_ema = _ema(puff_ema, (uint16_t) puff_units << EMA_FRACTION_BITS);
+        puff_units = 0;
+    }
+}
+
+void battery_set_load_resistance(uint16_t milliohms) {
+    load_resistance = milliohms;
+}
+
+uint16_t battery_get_rested_voltage(void) {
+    return rested_voltage;
+}
+
+uint16_t battery_get_sag(void) {
+    return sag_ema >> EMA_FRACTION_BITS;
+}
+
+uint16_t battery_get_internal_resistance(void) {
+    if (loaded_voltage == 0) {
+        return 0;
+    }
+    // R_i = sag / I with I = U_load / R_load
+    return (uint16_t) (((uint32_t) sag_ema * load_resistance / loaded_voltage) >> EMA_FRACTION_BITS);
+}
+
+uint16_t battery_get_drain(void) {
+    return drain_ema;
+}
+
+uint16_t battery_get_seconds_left(void) {
+    if (drain_ema == 0 || rested_voltage == 0) {
+        return BATTERY_UNKNOWN;
+    }
+    uint16_t predicted_loaded_voltage = rested_voltage - battery_get_sag();
+    if (rested_voltage <= battery_get_sag() || predicted_loaded_voltage <= BATTERY_VOLTAGE_STOP_VALUE) {
+        return 0;
+    }
+    uint32_t seconds = (uint32_t) (predicted_loaded_voltage - BATTERY_VOLTAGE_STOP_VALUE) * 1000 / drain_ema;
+    return (seconds >= BATTERY_UNKNOWN) ? BATTERY_UNKNOWN - 1 : (uint16_t) seconds;
+}
+
+uint16_t battery_get_puffs_left(void) {
+    uint16_t seconds = battery_get_seconds_left();
+    if (seconds == BATTERY_UNKNOWN || puff_ema == 0) {
+        return BATTERY_UNKNOWN;
+    }
+    // puff duration in s = units * BATTERY_FIRING_UNIT_MS / 1000
+    uint32_t puffs = ((uint32_t) seconds * (1000 / BATTERY_FIRING_UNIT_MS) << EMA_FRACTION_BITS) / puff_ema;
+    return (puffs >= BATTERY_UNKNOWN) ? BATTERY_UNKNOWN - 1 : (uint16_t) puffs;
+}
+
+uint16_t battery_get_state_of_charge(void) {
+    uint16_t voltage = loaded_since_rested ? loaded_voltage + battery_get_sag() : rested_voltage;
+    if (voltage == 0) {
+        return BATTERY_UNKNOWN;
+    }
+    if (voltage <= pgm_read_word(&soc_curve[0])) {
+        return 0;
+    }
+    if (voltage >= pgm_read_word(&soc_curve[SOC_CURVE_SIZE - 1])) {
+        return 100;
+    }
+    uint8_t ix = 1;
+    while (voltage > pgm_read_word(&soc_curve[ix])) {
+        ++ix;
+    }
+    uint16_t lower = pgm_read_word(&soc_curve[ix - 1]);
+    uint16_t upper = pgm_read_word(&soc_curve[ix]);
+    return (ix - 1) * SOC_CURVE_STEP + (voltage - lower) * SOC_CURVE_STEP / (upper - lower);
+}
@@ -0,0 +1,103 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+/** \defgroup battery Battery
+*   \brief Estimation of the battery's internal resistance, its voltage sag and the firing time left.
+*
+*   The module is fed with the battery measurements: rested ones (taken while not firing, after the battery had some
+*   time to relax) and loaded ones (taken while firing, at any rate), and with the firing time (battery_fired(), in
+*   units of #BATTERY_FIRING_UNIT_MS). All state is kept in fixed point exponential moving averages (EMA, new = old + (sample - old) / 2^#BATTERY_EMA_SHIFT), updated incrementally.
+*
+*   - The sag is the difference between the last rested and a loaded voltage.
+*   - The internal resistance (including MOSFET and wiring) follows from the sag and the load current, which is
+*     estimated from the loaded voltage and the load resistance (battery_set_load_resistance()).
+*   - The drain is the drop of the rested voltage per second of firing, taken between two rested measurements
+*     with at least #BATTERY_DRAIN_MIN_FIRE_SECONDS of firing in between.
+*   - The firing time left is the rested voltage minus the sag, down to #BATTERY_VOLTAGE_STOP_VALUE, divided by the drain;
+*     divided by the mean puff duration it gives the number of puffs left.
+*
+*   The state of charge maps the open circuit voltage through the discharge curve of the cell type (#BATTERY_CHEMISTRY),
+*   a PROGMEM table created by workbench/scripts/soccurve.py. The open circuit voltage is the last rested voltage or,
+*   if the battery was loaded since, the last loaded voltage plus the sag.
+*
+*   Divisions are only done per measurement (rarely), none of the functions is called from an ISR.
+*/
+
+#ifndef BATTERY_H
+#define BATTERY_H
+
+#include <avr/io.h>
+
+// Unit of the firing time in ms (the 50 ms pulses of the UI)
+#define BATTERY_FIRING_UNIT_MS 50
+
+// Weight of a new sample in the moving averages: 1 / 2^BATTERY_EMA_SHIFT
+#define BATTERY_EMA_SHIFT 3
+
+// Minimum firing time between two rested measurements to estimate the drain
+#define BATTERY_DRAIN_MIN_FIRE_SECONDS 5
+
+// Value of the predictions as long as they are unknown
+#define BATTERY_UNKNOWN 0xFFFF
+
+// Default load (coil) resistance in mOhm
+#define BATTERY_DEFAULT_LOAD_RESISTANCE 1500
+
+// Cell types for the state of charge (discharge curves)
+#define BATTERY_LI_ION      0   // LiCoO2 / NMC
+#define BATTERY_IMR         1   // LiMn2O4
+#define BATTERY_LIFEPO4     2
+#ifndef BATTERY_CHEMISTRY
+    #define BATTERY_CHEMISTRY BATTERY_LI_ION
+#endif
+
+void battery_rested_measurement(uint16_t millivolts);
+
+void battery_loaded_measurement(uint16_t millivolts);
+
+// Must be called while firing, with the firing time since the last call in units of BATTERY_FIRING_UNIT_MS
+void battery_fired(uint8_t units);
+
+// Must be called when firing stops (closes the puff for the mean puff duration)
+void battery_puff_finished(void);
+
+void battery_set_load_resistance(uint16_t milliohms);
+
+// Last rested voltage in mV (0 if unknown)
+uint16_t battery_get_rested_voltage(void);
+
+// Mean voltage sag under load in mV
+uint16_t battery_get_sag(void);
+
+// Internal resistance in mOhm (0 if unknown)
+uint16_t battery_get_internal_resistance(void);
+
+// Mean drop of the rested voltage in uV per second of firing (0 if unknown)
+uint16_t battery_get_drain(void);
+
+// Predicted firing time in s till the loaded voltage reaches BATTERY_VOLTAGE_STOP_VALUE (or BATTERY_UNKNOWN)
+uint16_t battery_get_seconds_left(void);
+
+// Predicted number of puffs of mean duration left (or BATTERY_UNKNOWN)
+uint16_t battery_get_puffs_left(void);
+
+// State of charge in % (0..100) or BATTERY_UNKNOWN as long as there is no measurement
+uint16_t battery_get_state_of_charge(void);
+
+#endif // BATTERY_H
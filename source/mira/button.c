@@ -16,6 +16,7 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 */
 
+#include <avr/pgmspace.h>
 #include "button.h"
 
 // BuTton State Machine States
@@ -24,103 +25,166 @@
 #define BTSMS_CLICK_UP      2   // button released after click, release state is so short that another click of the same click sequence could happen
 #define BTSMS_PRESSED       3   // button fully pressed, not a click
 #define BTSMS_TIMEOUT       4   // button ran into timeout while in pressed state
+#define BTSMS_STATE_MASK    0x07
 
+// BuTton state machine Inputs
+#define BTI_PRESS           0   // the button was pressed
+#define BTI_RELEASE         1   // the button was released
+#define BTI_EXPIRED         2   // the click duration of the button ran out (CLICK_DOWN and CLICK_UP only)
 
-void button_init(Button* button) {
-    queue_initialize(&(button->button_event_queue), 3, &(button->_button_event_queue_elements));
-    button->_click_press_duration = 3;
-    button->_click_release_duration = 3;
-    button->_state = BTSMS_IDLE;
-    button->_local_step_count = 0;
-    button->_click_count = 0;
-    button->_press_timeout = 160;
+// BuTton state machine Actions, combined with the next state in a transition
+#define BTA_START           (1<<3)  // start of a click sequence: reset the click count and report the press start
+#define BTA_CANCEL_START    (1<<4)  // cancel a reported press start
+#define BTA_CONFIRM_START   (1<<5)  // confirm a reported press start (without an event of its own)
+#define BTA_COUNT_CLICK     (1<<6)  // a click happened
+#define BTA_RESTART_TIMING  (1<<7)  // restart the click duration
+
+#define BTE_NONE            0xFF    // no event emitted by the transition
+
+typedef struct {
+    uint8_t next;       // next state and actions (BTSMS_*, BTA_*)
+    uint8_t event;      // event to emit (BUTTON_EVENT_*, BTE_NONE)
+} ButtonTransition;
+
+// The button state machine: the transition per state and input.
+// The unexpected inputs (two presses or releases in a row) lead to idle for safety, as well as from the click states.
+static const ButtonTransition transitions[][3] PROGMEM = {
+    [BTSMS_IDLE] = {
+        [BTI_PRESS] =   {BTSMS_CLICK_DOWN | BTA_START | BTA_RESTART_TIMING, BTE_NONE},  // first click or start of pressing
+        [BTI_RELEASE] = {BTSMS_IDLE, BTE_NONE},
+        [BTI_EXPIRED] = {BTSMS_IDLE, BTE_NONE},
+    },
+    [BTSMS_CLICK_DOWN] = {
+        [BTI_PRESS] =   {BTSMS_IDLE | BTA_CANCEL_START, BTE_NONE},
+        [BTI_RELEASE] = {BTSMS_CLICK_UP | BTA_CANCEL_START | BTA_COUNT_CLICK | BTA_RESTART_TIMING, BTE_NONE},
+        [BTI_EXPIRED] = {BTSMS_PRESSED | BTA_CONFIRM_START, BUTTON_EVENT_PRESSED},      // fully pressed
+    },
+    [BTSMS_CLICK_UP] = {
+        [BTI_PRESS] =   {BTSMS_CLICK_DOWN | BTA_RESTART_TIMING, BTE_NONE},             // next click of the sequence
+        [BTI_RELEASE] = {BTSMS_IDLE, BTE_NONE},
+        [BTI_EXPIRED] = {BTSMS_IDLE, BUTTON_EVENT_CLICK},                              // click sequence done
+    },
+    [BTSMS_PRESSED] = {
+        [BTI_PRESS] =   {BTSMS_PRESSED, BTE_NONE},
+        [BTI_RELEASE] = {BTSMS_IDLE, BUTTON_EVENT_RELEASED},
+        [BTI_EXPIRED] = {BTSMS_PRESSED, BTE_NONE},
+    },
+    [BTSMS_TIMEOUT] = {
+        [BTI_PRESS] =   {BTSMS_TIMEOUT, BTE_NONE},
+        [BTI_RELEASE] = {BTSMS_IDLE, BUTTON_EVENT_RELEASED_TIMEOUT},
+        [BTI_EXPIRED] = {BTSMS_TIMEOUT, BTE_NONE},
+    },
+};
+
+
+void buttons_init(Buttons* buttons) {
+    uint8_t ix;
+    queue_initialize(&(buttons->button_event_queue), BUTTON_EVENT_QUEUE_SIZE, buttons->_button_event_queue_elements);
+    for (ix = 0; ix < BUTTONS_MAX; ++ix) {
+        buttons->_state[ix] = BTSMS_IDLE;
+        buttons->_click_count[ix] = 0;
+    }
+    buttons->_states = 0;
+    buttons->_timing = 0;
+    buttons->_step_count0 = 0;
+    buttons->_step_count1 = 0;
+    buttons->_step_count2 = 0;
+    buttons->_report_press_start = 0;
+    buttons->_press_start_pending = 0;
 }
 
-void button_pressed(Button* button) {
-    switch (button->_state) {
-        case BTSMS_IDLE: {
-                button->_state = BTSMS_CLICK_DOWN;  // first click or start of pressing
-                button->_click_count = 0;
-                button->_local_step_count = 0;
-                break;
-        }
-        case BTSMS_CLICK_DOWN: {
-                button->_state = BTSMS_IDLE;        // should never happen, two pressed events without a release; go to idle for safety...
-                break;
-        }
-        case BTSMS_CLICK_UP: {
-                button->_local_step_count = 0;
-                button->_state = BTSMS_CLICK_DOWN;  // next click started (or maybe refusal of clicking sequence by pressing too long later)
-                break;
-        }
-        case BTSMS_TIMEOUT:
-        case BTSMS_PRESSED: {
-                break;  // should never happen, two pressed events without a release; go to idle for safety...
-        }
+void buttons_report_press_start(Buttons* buttons, uint8_t ix, uint8_t on) {
+    if (on) {
+        buttons->_report_press_start |= (1<<ix);
+    } else {
+        buttons->_report_press_start &= ~(1<<ix);
     }
 }
 
-void button_released(Button* button) {
-    switch (button->_state) {
-        case BTSMS_IDLE: {
-                break;                              // should never happen (maybe due to init race), just stay in idle...
-        }
-        case BTSMS_CLICK_DOWN: {
-                button->_click_count++;             // click happened
-                button->_state = BTSMS_CLICK_UP;
-                button->_local_step_count = 0;
-                break;
-        }
-        case BTSMS_CLICK_UP: {
-                button->_state = BTSMS_IDLE;        // should never happen, two released events without a pressed; go to idle for safety...
-                break;
+static void _put_event(Buttons* buttons, uint8_t ix, uint8_t event, uint8_t value) {
+    queue_put(&(buttons->button_event_queue), event | (ix << 4), value);
+}
+
+/**
+ * Runs the state machine of one button for one input.
+ */
+static void _transition(Buttons* buttons, uint8_t ix, uint8_t input) {
+    uint8_t bit = 1 << ix;
+    const ButtonTransition* transition = &transitions[buttons->_state[ix]][input];
+    uint8_t next = pgm_read_byte(&transition->next);
+    uint8_t event = pgm_read_byte(&transition->event);
+
+    if ((next & (BTA_CANCEL_START | BTA_CONFIRM_START)) && (buttons->_press_start_pending & bit)) {
+        buttons->_press_start_pending &= ~bit;
+        if (next & BTA_CANCEL_START) {
+            _put_event(buttons, ix, BUTTON_EVENT_PRESS_CANCELED, 0);    // (if reported, the press start was the first click)
         }
-        case BTSMS_TIMEOUT:
-        case BTSMS_PRESSED: {                       // button released after beeing "pressed"
-                QueueElement* e = queue_get_write_element(&(button->button_event_queue));
-                e->bytes.a = (button->_state == BTSMS_PRESSED ? BUTTON_EVENT_RELEASED: BUTTON_EVENT_RELEASED_TIMEOUT);
-                e->bytes.b = 0;
-                button->_state = BTSMS_IDLE;
-                break;
+    }
+    if (next & BTA_START) {
+        buttons->_click_count[ix] = 0;
+        if (buttons->_report_press_start & bit) {
+            _put_event(buttons, ix, BUTTON_EVENT_PRESS_STARTED, 0);
+            buttons->_press_start_pending |= bit;
         }
     }
+    if (next & BTA_COUNT_CLICK) {
+        buttons->_click_count[ix]++;
+    }
+    if (next & BTA_RESTART_TIMING) {
+        buttons->_step_count0 &= ~bit;
+        buttons->_step_count1 &= ~bit;
+        buttons->_step_count2 &= ~bit;
+    }
+    if (event != BTE_NONE) {
+        _put_event(buttons, ix, event, event == BUTTON_EVENT_CLICK ? buttons->_click_count[ix] : 0);
+    }
+
+    next &= BTSMS_STATE_MASK;
+    buttons->_state[ix] = next;
+    if (next == BTSMS_CLICK_DOWN || next == BTSMS_CLICK_UP) {
+        buttons->_timing |= bit;
+    } else {
+        buttons->_timing &= ~bit;
+    }
 }
 
-void button_step(Button* button){
-    button->_local_step_count++;
-    switch (button->_state) {
-        case BTSMS_TIMEOUT:
-        case BTSMS_IDLE: {
-                break;                              // nothing to do
-        }
-        case BTSMS_CLICK_DOWN: {
-
-                if (button->_local_step_count > button->_click_press_duration) {        // button fully pressed: emmit pressed event
-                    QueueElement* e = queue_get_write_element(&(button->button_event_queue));
-                    e->bytes.a = BUTTON_EVENT_PRESSED;
-                    e->bytes.b = 0;
-                    button->_state = BTSMS_PRESSED;
-                    button->_local_step_count = 0;
-                }
-                break;
+void buttons_set_states(Buttons* buttons, uint8_t states) {
+    uint8_t changed = states ^ buttons->_states;
+    uint8_t ix;
+    buttons->_states = states;
+    for (ix = 0; changed != 0; ++ix, changed >>= 1, states >>= 1) {
+        if (changed & 1) {
+            _transition(buttons, ix, (states & 1) ? BTI_PRESS : BTI_RELEASE);
         }
-        case BTSMS_CLICK_UP: {
-                if (button->_local_step_count > button->_click_release_duration) {     // click sequence done
-                    button->_state = BTSMS_IDLE;
-                    QueueElement* e = queue_get_write_element(&(button->button_event_queue));
-                    e->bytes.a = BUTTON_EVENT_CLICK;
-                    e->bytes.b = button->_click_count;
-                }
-                break;
-        }
-        case BTSMS_PRESSED: {
-                if (button->_press_timeout > 0 && button->_local_step_count > button->_press_timeout) {
-                    QueueElement* e = queue_get_write_element(&(button->button_event_queue));
-                    e->bytes.a = BUTTON_EVENT_TIMEOUT;
-                    e->bytes.b = 0;
-                    button->_state = BTSMS_TIMEOUT;
-                }
-                break;
+    }
+}
+
+void buttons_timeout(Buttons* buttons, uint8_t ix) {
+    if (buttons->_state[ix] == BTSMS_PRESSED) {
+        buttons->_state[ix] = BTSMS_TIMEOUT;    // (no timeout event, the caller knows already)
+    }
+}
+
+uint8_t buttons_are_idle(Buttons* buttons) {
+    return buttons->_timing == 0;               // (pressed buttons have no timeout of their own)
+}
+
+void buttons_step(Buttons* buttons) {
+    // count the steps of all timed buttons at once: three bit vertical counters (bit n of all buttons in
+    // _step_count<n>), a ripple carry through the bytes
+    uint8_t carry = buttons->_timing;
+    uint8_t expired;
+    uint8_t ix;
+    buttons->_step_count0 ^= carry;
+    carry &= ~buttons->_step_count0;
+    buttons->_step_count1 ^= carry;
+    carry &= ~buttons->_step_count1;
+    buttons->_step_count2 |= carry;
+    // the click duration (4 steps) ran out for the buttons that reached bit 2
+    expired = buttons->_step_count2 & buttons->_timing;
+    for (ix = 0; expired != 0; ++ix, expired >>= 1) {
+        if (expired & 1) {
+            _transition(buttons, ix, BTI_EXPIRED);
         }
     }
 }
@@ -17,24 +17,33 @@
 */
 
 /** \defgroup button Button
-*   \brief Abstraction for a button switch to generate press, release and click events.
+*   \brief Abstraction for up to 8 button switches to generate press, release and click events.
 *
-*   This module’s API consists of a struct type definition (#Button) and a few functions which all takes a reference
-*   to a #Button variable as first argument. This is kind of object oriented, where the struct keeps the buttons state
-*   and the methods act always exclusively on the struct.
+*   This module’s API consists of a struct type definition (#Buttons) and a few functions which all takes a reference
+*   to a #Buttons variable as first argument. This is kind of object oriented, where the struct keeps the state of all
+*   buttons and the methods act always exclusively on the struct. The buttons are identified by their index (0..7),
+*   which is usually the bit index of the switch in the input register.
 *
-*   A #Button struct is first initialized by the use of button_init(Button* button). During the buttons runtime,
-*   the function void button_step(Button* button) must be called cyclically. Furthermore, each time the (physical)
-*   button is pressed (debounced, if necessary), button_pressed(Button* button). If the (physical) button is released,
-*   button_released(Button* button) must be invoked. So, this module doesn't encapsulate the hardware part since it is
-*   highly application dependent.
+*   A #Buttons struct is first initialized by the use of buttons_init(Buttons* buttons). During the buttons runtime,
+*   the function buttons_step(Buttons* buttons) must be called cyclically. Furthermore, each time the (debounced)
+*   state of any (physical) button changes, buttons_set_states() must be called with the states of all buttons
+*   (one bit per button, 1 = pressed). So, this module doesn't encapsulate the hardware part since it is highly
+*   application dependent.
 *
-*   As a result from the mentioned inputs (cyclical step and pressed and released events), this button logic generate
+*   As a result from the mentioned inputs (cyclical step and the button states), this button logic generate
 *   click, pressed and released events where pressed is only emitted if the button was pressed long enough to “be not
-*   a click”.
+*   a click”. Each button runs its own state machine (a transition table, so only the changed buttons cost some time);
+*   the click timing of all buttons is counted at once by bit parallel counters, so buttons_step() takes the same time
+*   for any number of buttons.
 *
-*   The output events must be actively taken from a \ref queue. The events are decoded as integers, defined as preprocessor
-*   definitions \e BUTTON_EVENT_x.
+*   Optionally (buttons_report_press_start()), a button reports the start of a press sequence at once by a press
+*   started event, before it is known whether it becomes a press or a click. If the button is released as a click,
+*   a press canceled event follows (before the click event); if it's held long enough, the usual pressed event
+*   confirms it. Only the first press of a click sequence is reported this way.
+*
+*   The output events of all buttons must be actively taken from one \ref queue. The events are decoded as integers,
+*   defined as preprocessor definitions \e BUTTON_EVENT_x, in the lower nibble of byte a and the button index in
+*   the upper nibble (see BUTTON_EVENT_CODE() and BUTTON_EVENT_BUTTON()).
 *
 */
 
@@ -46,34 +55,86 @@
 #define BUTTON_EVENT_RELEASED   0
 #define BUTTON_EVENT_PRESSED    1
 #define BUTTON_EVENT_CLICK      2 // number of clicks in second byte
-#define BUTTON_EVENT_TIMEOUT    3
 #define BUTTON_EVENT_RELEASED_TIMEOUT    4
+#define BUTTON_EVENT_PRESS_STARTED  5 // only if enabled by buttons_report_press_start()
+#define BUTTON_EVENT_PRESS_CANCELED 6 // the started press turned out to be a click
+
+// Event code and button index of an event (byte a of the queue element)
+#define BUTTON_EVENT_CODE(a)    ((a) & 0x0F)
+#define BUTTON_EVENT_BUTTON(a)  ((a) >> 4)
+
+// Maximum number of buttons (one bit of the state masks each)
+#define BUTTONS_MAX 8
+
+// Number of elements of the button event queue, shared by all buttons (must be a power of two, see \ref queue)
+#define BUTTON_EVENT_QUEUE_SIZE 4
 
 typedef struct {
     Queue button_event_queue;
-    QueueElement _button_event_queue_elements[3];
-    uint8_t _state;
-    uint8_t _click_press_duration;
-    uint8_t _click_release_duration;
-    uint8_t _local_step_count;
-    uint8_t _click_count;
-    uint8_t _press_timeout;
-} Button;
+    QueueElement _button_event_queue_elements[BUTTON_EVENT_QUEUE_SIZE];
+    uint8_t _states;                // last button states given to buttons_set_states()
+    uint8_t _state[BUTTONS_MAX];    // state machine state per button
+    uint8_t _click_count[BUTTONS_MAX];
+    uint8_t _timing;                // buttons within a click sequence (their steps are counted)
+    uint8_t _step_count0;           // bit parallel step counters of the timed buttons (bit 0, 1 and 2 of the counts)
+    uint8_t _step_count1;
+    uint8_t _step_count2;
+    uint8_t _report_press_start;    // buttons that report the press start
+    uint8_t _press_start_pending;   // buttons whose press started event is sent, but neither confirmed nor canceled yet
+} Buttons;
 
 /**
- * \brief Must be called cyclically for each button instance.
+ * \brief Must be called cyclically for each buttons instance.
  *
  * This function must be called cyclically and is used by the button logic for the timing which is
- * important for the detection click events.
+ * important for the detection click events. It takes the same time for any number of buttons (as long as no
+ * click timing runs out).
  *
- * \param button the button instance
+ * \param buttons the buttons instance
  */
-void button_step(Button* button);
+void buttons_step(Buttons* buttons);
+
+void buttons_init(Buttons* buttons);
 
-void button_init(Button* button);
+/**
+ * \brief Returns 1 if buttons_step() has nothing to time right now (no click sequence running on any button).
+ *
+ * The steps may be paused then till the next buttons_set_states().
+ *
+ * \param buttons the buttons instance
+ */
+uint8_t buttons_are_idle(Buttons* buttons);
+
+/**
+ * \brief Feeds the (debounced) button states in, one bit per button (1 = pressed).
+ *
+ * Only the buttons whose bit differs from the last call are processed, so the states may be given again (e.g.
+ * after a lost update).
+ *
+ * \param buttons the buttons instance
+ * \param states the states of all buttons
+ */
+void buttons_set_states(Buttons* buttons, uint8_t states);
 
-void button_pressed(Button* button);
+/**
+ * \brief Enables (1) or disables (0) the press started and press canceled events of a button.
+ *
+ * A press that has already been reported is canceled or confirmed as usual, even if the reports are disabled meanwhile.
+ *
+ * \param buttons the buttons instance
+ * \param ix the button index
+ * \param on 1 to enable the events
+ */
+void buttons_report_press_start(Buttons* buttons, uint8_t ix, uint8_t on);
 
-void button_released(Button* button);
+/**
+ * \brief Puts a pressed button into the timeout state from outside (e.g. by a hardware timer).
+ *
+ * The release is reported as BUTTON_EVENT_RELEASED_TIMEOUT then.
+ *
+ * \param buttons the buttons instance
+ * \param ix the button index
+ */
+void buttons_timeout(Buttons* buttons, uint8_t ix);
 
 #endif // BUTTON_H
@@ -32,8 +32,12 @@ int main (void)
     #ifdef UART_ENABLED
         deviface_init();
     #endif
+    #ifdef MCU_FREE_RUNNING_TIMER
+        mcu_init_free_running_timer();
+    #endif
     hardware_init();
     ui_init();
+    logic_init();
 
     sei();
     logic_loop();
@@ -21,6 +21,7 @@
 #include <string.h>
 #include "queue.h"
 #include "deviface.h"
+#include "profile.h"
 #include MCUHEADER
 
 volatile uint8_t uart_str_complete = 0;
@@ -50,6 +51,14 @@ void deviface_putstring (char* s) {
     }
 }
 
+void deviface_putstring_P(const char* s) {
+    char c;
+    while ((c = pgm_read_byte(s))) {
+        deviface_putchar(c);
+        s++;
+    }
+}
+
 void deviface_putlineend(void) {
     deviface_putstring("\r\n");
 }
@@ -77,12 +86,77 @@ void deviface_put_uint16(uint16_t v) {
     deviface_putstring(value_s);
 }
 
+void deviface_put_uint32(uint32_t v) {
+    char value_s[11];
+    ultoa(v,value_s,10);
+    deviface_putstring(value_s);
+}
+
 void deviface_put_float(float v, int8_t width, uint8_t prec) {
     char value_s[20];
     dtostrf(v, width, prec,value_s);
     deviface_putstring(value_s);
 }
 
+void deviface_put_queue_statistics(char* name, Queue* queue) {
+    deviface_putstring(name);
+    deviface_putstring(": hwm ");
+    deviface_put_uint8(queue->high_water_mark);
+    deviface_putstring("/");
+    deviface_put_uint16(queue->mask + 1);
+    deviface_putstring(", ovf ");
+    deviface_put_uint8(queue->overflow_count);
+    deviface_putlineend();
+}
+
+#ifdef QUEUE_LATENCY_STATISTICS
+void deviface_put_queue_latency_header(void) {
+    deviface_putstring("wait times in ticks of ");
+    deviface_put_uint8(MCU_FREE_RUNNING_TIMER_PRESCALER);
+    deviface_putline(" cycles; <4 <16 <64 <256 <1k <4k <16k >=16k, max");
+}
+
+void deviface_put_queue_latency_statistics(char* name, Queue* queue) {
+    uint8_t n;
+    deviface_putstring(name);
+    deviface_putstring(":");
+    for (n = 0; n < QUEUE_LATENCY_BUCKETS; n++) {
+        deviface_putstring(" ");
+        deviface_put_uint16(queue->latency_histogram[n]);
+    }
+    deviface_putstring(", ");
+    deviface_put_uint16(queue->max_latency);
+    deviface_putlineend();
+}
+#endif
+
+void deviface_execute_command(const DevifaceCommandTable* const* tables, uint8_t table_count, const char* line) {
+    uint8_t help = (strcmp_P(line, PSTR("help")) == 0);
+    uint8_t t;
+    for (t = 0; t < table_count; t++) {
+        const DevifaceCommandTable* table = (const DevifaceCommandTable*) pgm_read_ptr(&tables[t]);
+        const DevifaceCommand* command = (const DevifaceCommand*) pgm_read_ptr(&table->commands);
+        uint8_t count = pgm_read_byte(&table->count);
+        for (; count > 0; count--, command++) {
+            if (help) {
+                deviface_putstring_P(command->name);
+                deviface_putstring(" - ");
+                deviface_putstring_P(command->help);
+                deviface_putlineend();
+            } else if (pgm_read_byte(command->name) == line[0] && strcmp_P(line, command->name) == 0) {
+                // (the first character is compared inline, strcmp_P is only called for the few candidates)
+                PROFILE_BEGIN(PROF_DEVIFACE);
+                ((DevifaceCommandHandler) pgm_read_ptr(&command->handler))();
+                PROFILE_END(PROF_DEVIFACE);
+                return;
+            }
+        }
+    }
+    if (!help && line[0] != '\0') {
+        deviface_putline("Unknown command, try help");
+    }
+}
+
 ISR(USART_RX_vect) {
 #ifdef UART_ENABLED
   unsigned char nextChar;
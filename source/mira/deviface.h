@@ -20,9 +20,38 @@
 #define DEVIFACE_H
 
 #include <avr/io.h>
+#include <avr/pgmspace.h>
+#include "queue.h"
 
 #define UART_MAXSTRLEN 10
 
+// Maximum length of a command's help text (including the terminating 0)
+#define DEVIFACE_HELP_MAXSTRLEN 28
+
+typedef void (*DevifaceCommandHandler)(void);
+
+/**
+ * A command of the developer interface. Commands are kept in flash (PROGMEM) only.
+ */
+typedef struct {
+    char name[UART_MAXSTRLEN + 1];          // the complete command line
+    DevifaceCommandHandler handler;         // called if the command line matches the name
+    char help[DEVIFACE_HELP_MAXSTRLEN];     // short description, printed by "help"
+} DevifaceCommand;
+
+/**
+ * The commands of a module: a PROGMEM array of #DevifaceCommand and its length.
+ * Each module that has commands provides such a table (in PROGMEM as well); the logic
+ * module collects all tables in a list that is passed to deviface_execute_command().
+ */
+typedef struct {
+    const DevifaceCommand* commands;
+    uint8_t count;
+} DevifaceCommandTable;
+
+// Initializer for a #DevifaceCommandTable from a #DevifaceCommand array
+#define DEVIFACE_COMMAND_TABLE(command_array) { command_array, sizeof(command_array) / sizeof(DevifaceCommand) }
+
 extern volatile uint8_t uart_str_complete;
 extern volatile uint8_t uart_str_count;
 extern volatile char uart_string[UART_MAXSTRLEN + 1];
@@ -31,6 +60,8 @@ void deviface_init(void);
 
 void deviface_put_uint16(uint16_t v);
 
+void deviface_put_uint32(uint32_t v);
+
 void deviface_put_uint8(uint8_t v);
 
 void deviface_put_int8(int8_t v);
@@ -43,6 +74,27 @@ void deviface_putstring(char* s);
 
 void deviface_putline(char* s);
 
+void deviface_putstring_P(const char* s);
+
 void deviface_putchar( unsigned char data );
 
+void deviface_put_queue_statistics(char* name, Queue* queue);
+
+/**
+ * \brief Looks up the command line in the command tables and calls the handler of the matching command.
+ *
+ * The command "help" is built in and lists the commands of all tables.
+ *
+ * \param tables PROGMEM array of pointers to PROGMEM command tables
+ * \param table_count number of command tables
+ * \param line the received command line
+ */
+void deviface_execute_command(const DevifaceCommandTable* const* tables, uint8_t table_count, const char* line);
+
+#ifdef QUEUE_LATENCY_STATISTICS
+void deviface_put_queue_latency_header(void);
+
+void deviface_put_queue_latency_statistics(char* name, Queue* queue);
+#endif
+
 #endif // DEVIFACE_H
@@ -17,18 +17,35 @@
 */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include "logic.h"
 #include "hardware.h"
 #include "queue.h"
+#include "profile.h"
+#include "battery.h"
 #include MCUHEADER
 #ifdef UART_ENABLED
     #include "deviface.h"
 #endif
 
-#define CTRLMAP_FIRE_BIT_MASK   (1 << HWMAP_HW_FIRE_BIT_IX)
-#define ALL_OUT_BITS            CTRLMAP_FIRE_BIT_MASK
+// Duty cycle of the fire PWM in percent (100: MOSFET permanently on)
+static uint8_t fire_duty_percent = 100;
+static uint8_t fire_is_on = 0;
 
+// Fire timeout: armed by hardware_fire_on(), the timer compare ISR counts its matches down (one per timer wrap)
+// and cuts the MOSFET at the last one (8 us resolution at 1 MHz, independent of the main loop).
+// On the atmega328p, it's the 16 bit free running timer. On the attiny45, it's the 8 bit UI timer whose compare
+// register is double buffered, so the matches are counted from the next overflow on at the remainder of the timeout.
+static uint16_t fire_timeout_ms = HW_FIRE_TIMEOUT_MS;
+static volatile uint16_t fire_timeout_matches = 0;  // compare matches till the timeout
+#ifdef MCU_FIRE_TIMEOUT_OCR_DOUBLE_BUFFERED
+static uint8_t fire_timeout_compare = 0;            // value last written to the compare register
+#endif
+static volatile uint8_t fire_timed_out = 0;         // set by the ISR when it has cut the MOSFET, till the fire is off
+static uint8_t fire_timeout_reported = 0;           // HW__FIRE_TIMEOUT is sent (by hardware_step())
 
 // state machine: battery voltage measurement (bvm)
 #define SMS_BVM_IDLE 0
@@ -38,89 +55,334 @@
 uint8_t sm_bvm_status = SMS_BVM_IDLE;
 
 uint8_t make_measurement = 0;
+static uint8_t requested_tag = HW_BVM_RESTED;       // tag of the requested measurement (see do_battery_measurement())
+
+// Oversampling: each measurement takes 4^BVM_OVERSAMPLING_BITS conversions, their sum is decimated to a
+// (10 + BVM_OVERSAMPLING_BITS) bit value (the ADC noise of about one LSB dithers the extra bits).
+// 2: 16 conversions, 3: 64 conversions (about 7 ms at 125 kHz ADC clock)
+#define BVM_OVERSAMPLING_BITS 3
+#define BVM_SAMPLES (1 << (2 * BVM_OVERSAMPLING_BITS))
+#if BVM_OVERSAMPLING_BITS > 3
+    #error "BVM_OVERSAMPLING_BITS > 3 overflows the 16 bit ADC sum"
+#endif
+#define BVM_DISCARDED_SAMPLES 1     // conversions discarded before (the band gap input settles after the ADC was idle)
+
+// Battery voltage in mV for the decimated ADC value (band gap reference of 1100 mV, BVM_OVERSAMPLING_BITS 3):
+// entry i is the voltage at BVM_TABLE_FIRST + i * 2^BVM_TABLE_SHIFT, the values in between are interpolated
+// (max. error 3 mV). The ADC measures the band gap against V_CC (adc = 1024 * V_BG / V_CC), so this replaces a division.
+// created by "adctable.py -s 3 -l 2400 -u 5000 -k 6"
+#define BVM_TABLE_FIRST 1792    // 5029 mV
+#define BVM_TABLE_SHIFT 6
+#define BVM_TABLE_SIZE 32
+#if BVM_OVERSAMPLING_BITS != 3
+    #error "the battery voltage table must be created for BVM_OVERSAMPLING_BITS"
+#endif
+static const uint16_t bvm_table[BVM_TABLE_SIZE] PROGMEM = {
+ 5029,  4855,  4693,  4542,  4400,  4267,  4141,  4023,
+ 3911,  3805,  3705,  3610,  3520,  3434,  3352,  3274,
+ 3200,  3129,  3061,  2996,  2933,  2873,  2816,  2761,
+ 2708,  2657,  2607,  2560,  2514,  2470,  2428,  2386
+};
+
+// The conversions of a measurement are done by the ADC ISR, which restarts the ADC till the measurement is complete.
+static volatile uint16_t adc_sum = 0;               // sum of the raw results, read by sm_bvm() after the ISR is done
+static volatile uint8_t adc_samples_to_go = 0;      // conversions left in the current measurement (0: no measurement)
+static volatile uint8_t adc_measurement_done = 0;   // set by the ISR after the last conversion
+static uint8_t measurement_tag = HW_BVM_RESTED;     // tag of the running measurement
 
-#define AVR_INTERNAL_REFERENCE_VOLTAGE 1100000L     // in 10^(-6) V
-#define BVM_SMOOTHING 4
-uint16_t battery_voltage_sum = 0;
-uint8_t battery_voltage_values_ix = 0;
+// Coil check: when firing starts, the MOSFET is switched fully on and the ADC converts the voltage over the current
+// sense shunt (a battery measurement waits), in two stages:
+// 1) One conversion against V_CC with the fast ADC clock (about 8 bit): a short is far above the noise there
+//    (COIL_SHORT_SENSE_VALUE is about 170), so the ADC ISR cuts the MOSFET at once.
+//    Trip latency (estimated at 1 MHz): 26 us conversion plus about 60 us ISR till the cut, plus up to 104 us if a
+//    battery conversion is running at fire start.
+// 2) Otherwise COIL_PRECISE_SAMPLES conversions against the internal 1.1 V reference with the precise ADC clock
+//    (125 kHz at 1 MHz), after the reference has settled (MCU_ADC_REFERENCE_SETTLE_CONVERSIONS): about 0.5 ms on
+//    the attiny45, 3.5 ms on the atmega328p. The 20 mOhm shunt gives about 80 mV at 1 Ohm and 4 V, so the sum
+//    resolves the sense voltage to 0.27 mV (the 1 Ohm coil reads about 290, 0.3% per count). The ISR cuts the MOSFET
+//    for an open coil (the threshold is derived from the last rested battery voltage at fire start), hardware_step()
+//    then reports the fault or derives the resistance and applies the duty cycle.
+// The profile section "coil" measures the check from fire on till the decision.
+// The resistance follows from the battery voltage at the coil (the rested one minus the drop over the internal
+// resistance, see battery.h) and the current: R_coil + R_shunt = V / I with I = V_sense / R_shunt
+// (the battery voltage is measured against the same band gap, so its tolerance cancels out)
+#define COIL_SHUNT_MILLIOHMS 20
+#define COIL_SHORT_SENSE_VALUE ((uint16_t) (1024UL * COIL_SHUNT_MILLIOHMS / (HW_COIL_MIN_MILLIOHMS + COIL_SHUNT_MILLIOHMS)))
+#define COIL_PRECISE_SAMPLES 4
+#define COIL_REFERENCE_MILLIVOLTS 1100
+// Sense voltage in uV for the sum of the precise conversions: sum * COIL_SUM_MICROVOLTS_X1024 / 1024
+#define COIL_SUM_MICROVOLTS_X1024 (COIL_REFERENCE_MILLIVOLTS * 1000UL / COIL_PRECISE_SAMPLES)
+// Battery voltage for the check as long as there was no rested measurement
+#define COIL_NOMINAL_MILLIVOLTS 3700
+
+#define COIL_CHECK_IDLE 0
+#define COIL_CHECK_REQUESTED 1      // waits for the running conversion, the ADC ISR starts the check then
+#define COIL_CHECK_SENSING 2        // the fast conversion (short check) is running
+#define COIL_CHECK_MEASURING 3      // the precise conversions (open check and resistance) are running
+#define COIL_CHECK_DONE 4           // the ISR is done, coil_fault and coil_sense_value are valid
+static volatile uint8_t coil_check = COIL_CHECK_IDLE;
+static volatile uint8_t coil_sense_running = 0;     // the ADC converts the coil sense input (also if the check was canceled)
+static volatile uint8_t coil_samples_to_go = 0;     // conversions left in the precise stage (settling ones included)
+static volatile uint8_t coil_fault = 0;             // HW_COIL_SHORT, HW_COIL_OPEN or 0
+static volatile uint16_t coil_sense_value = 0;      // sum of the precise conversions
+static uint16_t coil_open_sense_value = 0;          // sum at HW_COIL_MAX_MILLIOHMS for the battery voltage at fire start
+static uint16_t coil_resistance = 0;                // in mOhm, from the last check without fault
+
+// If 1, the main loop sleeps in the ADC noise reduction mode while a conversion is running (and we don't fire).
+// This stops the UART as well, so it's off by default if it's there (see the deviface command "adc nr").
+#ifdef UART_ENABLED
+static uint8_t adc_noise_reduction = 0;
+#else
+static uint8_t adc_noise_reduction = 1;
+#endif
+
+// Number of elements of the hardware event queue (must be a power of two, see \ref queue)
+#define HW_EVENT_QUEUE_SIZE 8
+#define HW_URGENT_EVENT_QUEUE_SIZE 4     // the logic takes them after each urgent UI event (fire off, on and timeout)
 
 Queue hw_event_queue;
-QueueElement hw_event_queue_elements[5];
+QueueElement hw_event_queue_elements[HW_EVENT_QUEUE_SIZE];
+Queue hw_urgent_event_queue;
+QueueElement hw_urgent_event_queue_elements[HW_URGENT_EVENT_QUEUE_SIZE];
+
+// HW__FIRE_ON or HW__FIRE_OFF that didn't fit into the urgent queue (0 if none), put again by hardware_step()
+static uint8_t fire_event_pending = 0;
 
+static void _put_battery_prognosis(void) {
+    queue_put_value(&hw_event_queue, HW__BATTERY_PROGNOSIS, battery_get_seconds_left());
+}
+
+/**
+ * Puts the fire on or off event for the logic, or keeps it pending if it doesn't fit (only the latest one counts).
+ */
+static void _put_fire_event(uint8_t code) {
+    if (fire_event_pending || queue_put(&hw_urgent_event_queue, code, 0) == QUEUE_DROPPED) {
+        fire_event_pending = code;
+    }
+}
 
 uint8_t hardware_init(void) {
-    // configure the fire pin as output by setting the related direction bit to 1
-    HWMAP_HW_FIRE_DDR |= CTRLMAP_FIRE_BIT_MASK;
-    // initialize the fire pin with 0 (fire off)
-    HWMAP_HW_FIRE_PORT &= ~CTRLMAP_FIRE_BIT_MASK;
+    // configure the fire pin as output (fire off) and its PWM timer
+    mcu_init_fire_pwm();
     // set up the hardware event queue
-    queue_initialize(&hw_event_queue, 5, hw_event_queue_elements);
+    queue_initialize(&hw_event_queue, HW_EVENT_QUEUE_SIZE, hw_event_queue_elements);
+    queue_initialize(&hw_urgent_event_queue, HW_URGENT_EVENT_QUEUE_SIZE, hw_urgent_event_queue_elements);
     // enable the ADC which uses V_CC as reference and the constant voltage V_GB as input
     mcu__enabled_one_adc_with_vcc_reference_and_vgb_input();
+    MCU__ENABLE_ADC_INTERRUPT;          // (shared by the battery measurement and the coil check, see the ADC ISR)
 
     return 0;
 }
 
+// The fire duty cycle in PWM steps of the MCU
+static uint8_t _fire_duty_steps(void) {
+    return (uint8_t) (((uint16_t) fire_duty_percent * MCU_FIRE_PWM_STEPS + 50) / 100);
+}
+
+/**
+ * Applies the duty cycle to the running fire, unless the fire timeout has cut it (which stays cut till the fire
+ * is switched off, even if the main loop hasn't seen the timeout yet). Atomic, since the timeout ISR may cut it
+ * concurrently.
+ */
+static void _apply_fire_duty(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (!fire_timed_out) {
+            mcu_set_fire_pwm(_fire_duty_steps());
+        }
+    }
+}
+
+/**
+ * Returns the battery voltage in mV the coil check is based on (the last rested one).
+ */
+static uint16_t _coil_check_millivolts(void) {
+    uint16_t millivolts = battery_get_rested_voltage();
+    return millivolts ? millivolts : COIL_NOMINAL_MILLIVOLTS;
+}
+
+/**
+ * Starts the coil sense conversion. The ADC must not be busy, so it's called by the ADC ISR or with interrupts disabled.
+ */
+static void _start_coil_sense_conversion(void) {
+    MCU__SELECT_ADC_COIL_SENSE_INPUT;
+    MCU__SELECT_ADC_VCC_REFERENCE;
+    MCU__SET_ADC_CLOCK_FAST;
+    coil_sense_running = 1;
+    coil_check = COIL_CHECK_SENSING;
+    MCU__START_SINGLE_ADC_CONVERSION;
+}
+
+/**
+ * Arms the fire timeout (fire_timeout_ms from now on).
+ */
+static void _arm_fire_timeout(void) {
+    uint32_t ticks = (uint32_t) fire_timeout_ms * MCU_FIRE_TIMEOUT_TICKS_PER_MS;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        MCU__CLEAR_FIRE_TIMEOUT_FLAG;
+        #ifdef MCU_FIRE_TIMEOUT_OCR_DOUBLE_BUFFERED
+        uint8_t now = MCU_FIRE_TIMEOUT_TIMER;
+        if (fire_timeout_compare == now) {
+            // the old compare value matches at this count, before or after the flag was cleared: let the count
+            // pass (one timer tick) and ask the flag
+            while (MCU_FIRE_TIMEOUT_TIMER == now);
+            now = MCU_FIRE_TIMEOUT_TIMER;
+        }
+        // a match at the old compare value after clearing the flag counts as well: it's still ahead in this period
+        // or it has set the flag already
+        uint8_t stale_match = (fire_timeout_compare > now) || MCU__FIRE_TIMEOUT_FLAG_IS_SET;
+        ticks -= 256 - now;                 // from the next overflow on (the timeout is always longer)
+        if ((uint8_t) ticks == 0xFF) {
+            ++ticks;                        // (never compare at TOP, so waiting for a count above never wraps)
+        }
+        fire_timeout_compare = (uint8_t) ticks;
+        MCU_FIRE_TIMEOUT_OCR = fire_timeout_compare;
+        fire_timeout_matches = (uint16_t) (ticks >> 8) + 1 + stale_match;
+        #else
+        // the compare value applies at once: the first match is the remainder of the timer range from now on
+        if ((uint16_t) ticks < 2) {
+            ticks += 2;                     // (the timer must not pass the compare value before it's written)
+        }
+        MCU_FIRE_TIMEOUT_OCR = MCU_FIRE_TIMEOUT_TIMER + (uint16_t) ticks;
+        fire_timeout_matches = (uint16_t) (ticks >> MCU_FIRE_TIMEOUT_TIMER_BITS) + 1;
+        #endif
+        fire_timed_out = 0;
+        fire_timeout_reported = 0;
+        MCU__ENABLE_FIRE_TIMEOUT_INTERRUPT;
+    }
+}
+
+ISR(MCU_FIRE_TIMEOUT_ISR) {
+    if (--fire_timeout_matches == 0) {
+        mcu_set_fire_pwm(0);
+        MCU__DISABLE_FIRE_TIMEOUT_INTERRUPT;
+        fire_timed_out = 1;
+    }
+}
+
 void hardware_fire_on(void) {
+    // (switch first, printing takes a few ms; fully on till the coil check is done)
+    mcu_set_fire_pwm(MCU_FIRE_PWM_STEPS);
+    fire_is_on = 1;
+    PROFILE_END_MARK(PROF_FIRE_LATENCY);
+    PROFILE_MARK(PROF_COIL_CHECK);
+    _arm_fire_timeout();
+    // sum of the precise conversions at HW_COIL_MAX_MILLIOHMS: V_sense in uV = I in mA * R_shunt in mOhm
+    uint32_t open_current_ma = (uint32_t) _coil_check_millivolts() * 1000 / (HW_COIL_MAX_MILLIOHMS + COIL_SHUNT_MILLIOHMS);
+    uint16_t open_sense_value = (uint16_t) ((open_current_ma * COIL_SHUNT_MILLIOHMS << 10) / COIL_SUM_MICROVOLTS_X1024);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        coil_open_sense_value = open_sense_value;
+        if (MCU__ADC_BUSY) {
+            coil_check = COIL_CHECK_REQUESTED;
+        } else {
+            _start_coil_sense_conversion();
+        }
+    }
     #ifdef UART_ENABLED
     deviface_putline(">Fire On");
     #endif
-    HWMAP_HW_FIRE_PORT = HWMAP_HW_FIRE_PORT | CTRLMAP_FIRE_BIT_MASK;
-    QueueElement* e = queue_get_write_element(&hw_event_queue);
-    e->bytes.a = HW__FIRE_ON;
+    _put_fire_event(HW__FIRE_ON);
 }
 
 void hardware_fire_off(void) {
+    // (the ADC ISR or the fire timeout may cut the MOSFET concurrently, which is the same)
+    mcu_set_fire_pwm(0);
+    MCU__DISABLE_FIRE_TIMEOUT_INTERRUPT;
+    fire_timed_out = 0;
+    fire_timeout_reported = 0;
+    if (coil_check != COIL_CHECK_IDLE) {
+        coil_check = COIL_CHECK_IDLE;   // drop a running coil check
+        PROFILE_UNMARK(PROF_COIL_CHECK);
+    }
+    if (fire_is_on) {
+        fire_is_on = 0;
+        battery_puff_finished();
+        _put_battery_prognosis();
+    }
     #ifdef UART_ENABLED
     deviface_putline(">Fire Off");
     #endif
-    HWMAP_HW_FIRE_PORT = HWMAP_HW_FIRE_PORT & ~CTRLMAP_FIRE_BIT_MASK;
-    QueueElement* e = queue_get_write_element(&hw_event_queue);
-    e->bytes.a = HW__FIRE_OFF;
+    _put_fire_event(HW__FIRE_OFF);
 }
 
 void hardware_power_down() {
     sm_bvm_status = SMS_BVM_IDLE;       // stop the battery voltage measure in case it's running
+    MCU__DISABLE_ADC_INTERRUPT;
+    adc_samples_to_go = 0;
+    coil_check = COIL_CHECK_IDLE;
     queue_clear(&hw_event_queue);        // clear unprocessed events if there are some
+    queue_clear(&hw_urgent_event_queue);
+    fire_event_pending = 0;
 }
 
 void hardware_power_up() {
-    // nothing to do
+    MCU__ENABLE_ADC_INTERRUPT;          // (a pending interrupt of a conversion before the power down is handled then)
+}
+
+/**
+ * Looks up the battery voltage in mV for the decimated ADC value (clamped to the table range).
+ */
+static uint16_t _adc_to_millivolts(uint16_t adc_value) {
+    if (adc_value <= BVM_TABLE_FIRST) {
+        return pgm_read_word(&bvm_table[0]);
+    }
+    uint16_t offset = adc_value - BVM_TABLE_FIRST;
+    uint8_t ix = offset >> BVM_TABLE_SHIFT;
+    if (ix >= BVM_TABLE_SIZE - 1) {
+        return pgm_read_word(&bvm_table[BVM_TABLE_SIZE - 1]);
+    }
+    uint8_t fraction = offset & ((1 << BVM_TABLE_SHIFT) - 1);
+    uint16_t upper = pgm_read_word(&bvm_table[ix]);         // (higher voltage at the lower ADC value)
+    uint16_t lower = pgm_read_word(&bvm_table[ix + 1]);
+    return upper - (uint16_t) (((uint16_t) (upper - lower) * fraction) >> BVM_TABLE_SHIFT);
 }
 
 void sm_bvm(void) {
     switch (sm_bvm_status) {
         case SMS_BVM_IDLE: {
             if (make_measurement == 1) {
-                MCU__START_SINGLE_ADC_CONVERSION;
-                battery_voltage_values_ix = 0;
-                sm_bvm_status = SMS_BVM_MEASURING;
                 make_measurement = 0;
-                battery_voltage_sum = 0;
+                if (requested_tag != fire_is_on) {
+                    break;                          // firing started or stopped since the request
+                }
+                measurement_tag = requested_tag;
+                sm_bvm_status = SMS_BVM_MEASURING;
+                ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+                    adc_sum = 0;
+                    adc_measurement_done = 0;
+                    adc_samples_to_go = BVM_DISCARDED_SAMPLES + BVM_SAMPLES;
+                    if (!MCU__ADC_BUSY) {
+                        MCU__START_SINGLE_ADC_CONVERSION;   // the ADC ISR does the rest...
+                    }                                       // ...or starts it after the coil check
+                }
             }
             break;
         }
         case SMS_BVM_MEASURING: {
-            if (MCU__SINGLE_ADC_CONVERSION_IS_DONE) {
-                // measurement done
-                uint8_t adc_low = ADCL;     // get the low byte of the measured value
-                uint8_t adc_high = ADCH;    // get the high byte of the measured value
-                uint16_t adc_result = (adc_high<<8) | adc_low; //put the 16 bit measurement result together
-                uint16_t vcc =  AVR_INTERNAL_REFERENCE_VOLTAGE / adc_result;   //turn the raw adc value into milli volt
-                battery_voltage_sum += vcc;
-                if (++battery_voltage_values_ix == BVM_SMOOTHING) {
-                    sm_bvm_status = SMS_BVM_CALCULATING;
-                } else {
-                   MCU__START_SINGLE_ADC_CONVERSION;            // start another measurement, stay in this state...
-                }
+            if (adc_measurement_done) {
+                sm_bvm_status = SMS_BVM_CALCULATING;
             }
             break;
         }
         case SMS_BVM_CALCULATING: {
-            // and put the final result into the event queue
-            QueueElement* e = queue_get_write_element(&hw_event_queue);
-            e->bytes.a = HW__BATTERY_MEASURE;
-            e->bytes.b = (uint8_t) (battery_voltage_sum / (BVM_SMOOTHING * 100));
+            // decimate the sum, turn it into the battery voltage and put it into the event queue
+            // (the ISR doesn't touch adc_sum anymore)
+            uint16_t adc_value = adc_sum >> BVM_OVERSAMPLING_BITS;      // in 1/2^BVM_OVERSAMPLING_BITS LSB
+            uint16_t battery_voltage = _adc_to_millivolts(adc_value);
+            // report it and feed the estimator (unless firing started or stopped during the measurement)
+            if (measurement_tag == fire_is_on) {
+                if (measurement_tag == HW_BVM_LOADED) {
+                    queue_put_value(
+                        (battery_voltage <= BATTERY_VOLTAGE_STOP_VALUE ? &hw_urgent_event_queue : &hw_event_queue),
+                        HW__BATTERY_MEASURE,
+                        battery_voltage
+                    );
+                    battery_loaded_measurement(battery_voltage);
+                } else {
+                    queue_put_value(&hw_event_queue, HW__BATTERY_MEASURE_RESTED, battery_voltage);
+                    battery_rested_measurement(battery_voltage);
+                    _put_battery_prognosis();
+                }
+            }
             // go back to the idle state to wait for the next measurement instruction
             sm_bvm_status = SMS_BVM_IDLE;
             break;
@@ -128,13 +390,266 @@ void sm_bvm(void) {
     }
 }
 
+/**
+ * Processes the result of the coil check (the ADC ISR has already cut the MOSFET on a fault).
+ */
+static void _finish_coil_check(void) {
+    coil_check = COIL_CHECK_IDLE;
+    if (coil_fault) {
+        // the logic switches the fire off (reported after the fault), it's not a puff for the battery estimation
+        fire_is_on = 0;
+        queue_put_value(&hw_event_queue, HW__COIL_FAULT, coil_fault);
+        #ifdef UART_ENABLED
+        deviface_putline(coil_fault == HW_COIL_SHORT ? ">Coil short" : ">Coil open");
+        #endif
+    } else {
+        // coil_sense_value is above the open threshold, so the current is not 0
+        uint32_t current_ma = (((uint32_t) coil_sense_value * COIL_SUM_MICROVOLTS_X1024) >> 10) / COIL_SHUNT_MILLIOHMS;
+        uint32_t drop_mv = current_ma * battery_get_internal_resistance() / 1000;
+        uint16_t voltage = _coil_check_millivolts();
+        uint32_t load_mv = (drop_mv < voltage) ? voltage - drop_mv : 0;
+        uint32_t total = load_mv * 1000 / current_ma;
+        coil_resistance = (total > COIL_SHUNT_MILLIOHMS) ? (uint16_t) (total - COIL_SHUNT_MILLIOHMS) : 0;
+        battery_set_load_resistance(coil_resistance);
+        _apply_fire_duty();
+    }
+}
+
 void hardware_step(void) {
-    if (~ global_state && GS_AWAKENING) {
-        // if the device is not jus awakening (but really switched on)
+    if (fire_event_pending && queue_put(&hw_urgent_event_queue, fire_event_pending, 0) != QUEUE_DROPPED) {
+        fire_event_pending = 0;
+    }
+    if (fire_timed_out && !fire_timeout_reported) {
+        // the logic switches the fire off
+        fire_timeout_reported = 1;
+        queue_put(&hw_urgent_event_queue, HW__FIRE_TIMEOUT, 0);
+    }
+    if (coil_check == COIL_CHECK_DONE) {
+        _finish_coil_check();
+    }
+    if (!logic_device_is_in(DS_AWAKENING)) {
+        // if the device is not just awakening (but really switched on)
+        PROFILE_BEGIN(PROF_SM_BVM);
         sm_bvm();
+        PROFILE_END(PROF_SM_BVM);
     }
 }
 
-void do_battery_measurement(void) {
+ISR(MCU_ADC_ISR) {
+    uint16_t result = MCU__ADC_RESULT;
+    if (coil_sense_running) {
+        coil_sense_running = 0;
+        if (coil_check == COIL_CHECK_SENSING) {
+            if (result >= COIL_SHORT_SENSE_VALUE) {
+                mcu_set_fire_pwm(0);        // trip
+                coil_fault = HW_COIL_SHORT;
+                coil_sense_value = result;
+                coil_check = COIL_CHECK_DONE;
+                PROFILE_END_MARK(PROF_COIL_CHECK);
+            } else {
+                // no short: measure precisely against the internal reference
+                MCU__SELECT_ADC_INTERNAL_REFERENCE;
+                MCU__SET_ADC_CLOCK_PRECISE;
+                coil_sense_value = 0;
+                coil_samples_to_go = MCU_ADC_REFERENCE_SETTLE_CONVERSIONS + COIL_PRECISE_SAMPLES;
+                coil_check = COIL_CHECK_MEASURING;
+                coil_sense_running = 1;
+                MCU__START_SINGLE_ADC_CONVERSION;
+                return;
+            }
+        } else if (coil_check == COIL_CHECK_MEASURING) {
+            if (coil_samples_to_go <= COIL_PRECISE_SAMPLES) {
+                coil_sense_value += result;
+            }
+            if (--coil_samples_to_go != 0) {
+                coil_sense_running = 1;
+                MCU__START_SINGLE_ADC_CONVERSION;
+                return;
+            }
+            if (coil_sense_value <= coil_open_sense_value) {
+                mcu_set_fire_pwm(0);        // trip
+                coil_fault = HW_COIL_OPEN;
+            } else {
+                coil_fault = 0;
+            }
+            coil_check = COIL_CHECK_DONE;
+            PROFILE_END_MARK(PROF_COIL_CHECK);
+        }
+        MCU__SELECT_ADC_VCC_REFERENCE;
+        MCU__SELECT_ADC_BANDGAP_INPUT;
+        MCU__SET_ADC_CLOCK_PRECISE;
+        if (coil_check != COIL_CHECK_REQUESTED) {
+            if (adc_samples_to_go != 0) {
+                // restart the battery measurement the check has interrupted (the band gap input and the
+                // reference settle again)
+                adc_sum = 0;
+                adc_samples_to_go = MCU_ADC_REFERENCE_SETTLE_CONVERSIONS + BVM_DISCARDED_SAMPLES + BVM_SAMPLES;
+                MCU__START_SINGLE_ADC_CONVERSION;
+            }
+            return;
+        }
+    }
+    if (coil_check == COIL_CHECK_REQUESTED) {
+        // fire started while converting: the check goes first (a battery conversion is dropped, see above)
+        _start_coil_sense_conversion();
+        return;
+    }
+    if (adc_samples_to_go == 0) {
+        return;                             // measurement canceled
+    }
+    if (adc_samples_to_go <= BVM_SAMPLES) {
+        adc_sum += result;
+    }
+    if (--adc_samples_to_go == 0) {
+        adc_measurement_done = 1;
+    } else {
+        MCU__START_SINGLE_ADC_CONVERSION;
+    }
+}
+
+uint8_t hardware_is_idle(void) {
+    // while measuring, there's only something to do when the ISR is done
+    return make_measurement == 0
+        && fire_event_pending == 0
+        && coil_check != COIL_CHECK_DONE
+        && (fire_timed_out == 0 || fire_timeout_reported)
+        && (sm_bvm_status == SMS_BVM_IDLE || (sm_bvm_status == SMS_BVM_MEASURING && adc_measurement_done == 0));
+}
+
+uint8_t hardware_wants_adc_noise_reduction(void) {
+    return adc_noise_reduction
+        && sm_bvm_status == SMS_BVM_MEASURING
+        && adc_measurement_done == 0
+        && fire_is_on == 0;         // (the fire PWM timer would pause)
+}
+
+void do_battery_measurement(uint8_t tag) {
+    requested_tag = tag;
     make_measurement = 1;
 }
+
+void hardware_set_fire_duty(uint8_t percent) {
+    fire_duty_percent = (percent > 100) ? 100 : percent;
+    if (fire_is_on && coil_check == COIL_CHECK_IDLE) {      // (otherwise it's applied after the coil check)
+        _apply_fire_duty();
+    }
+}
+
+uint8_t hardware_get_fire_duty(void) {
+    return fire_duty_percent;
+}
+
+void hardware_set_fire_timeout(uint16_t milliseconds) {
+    if (milliseconds < HW_FIRE_TIMEOUT_MIN_MS) {
+        milliseconds = HW_FIRE_TIMEOUT_MIN_MS;
+    } else if (milliseconds > HW_FIRE_TIMEOUT_MAX_MS) {
+        milliseconds = HW_FIRE_TIMEOUT_MAX_MS;
+    }
+    fire_timeout_ms = milliseconds;
+}
+
+uint16_t hardware_get_fire_timeout(void) {
+    return fire_timeout_ms;
+}
+
+uint16_t hardware_get_coil_resistance(void) {
+    return coil_resistance;
+}
+
+#ifdef UART_ENABLED
+static void _command_measure_battery(void) {
+    do_battery_measurement(fire_is_on ? HW_BVM_LOADED : HW_BVM_RESTED);
+}
+
+static void _command_print_fire_duty(void) {
+    deviface_putstring("Fire duty: ");
+    deviface_put_uint8(fire_duty_percent);
+    deviface_putstring("% of ");
+    deviface_put_uint8(MCU_FIRE_PWM_STEPS);
+    deviface_putstring(" steps at ");
+    deviface_put_uint16(MCU_FIRE_PWM_FREQUENCY);
+    deviface_putline(" Hz");
+}
+
+static void _command_increase_fire_duty(void) {
+    hardware_set_fire_duty(fire_duty_percent + 10);
+    _command_print_fire_duty();
+}
+
+static void _command_decrease_fire_duty(void) {
+    hardware_set_fire_duty(fire_duty_percent < 10 ? 0 : fire_duty_percent - 10);
+    _command_print_fire_duty();
+}
+
+static void _command_print_fire_timeout(void) {
+    deviface_putstring("Fire timeout: ");
+    deviface_put_uint16(fire_timeout_ms);
+    deviface_putline(" ms");
+}
+
+static void _command_increase_fire_timeout(void) {
+    hardware_set_fire_timeout(fire_timeout_ms + 1000);
+    _command_print_fire_timeout();
+}
+
+static void _command_decrease_fire_timeout(void) {
+    hardware_set_fire_timeout(fire_timeout_ms > 1000 ? fire_timeout_ms - 1000 : 0);
+    _command_print_fire_timeout();
+}
+
+static void _command_print_battery_estimation(void) {
+    deviface_putstring("rested ");
+    deviface_put_uint16(battery_get_rested_voltage());
+    deviface_putstring(" mV, sag ");
+    deviface_put_uint16(battery_get_sag());
+    deviface_putstring(" mV, R_i ");
+    deviface_put_uint16(battery_get_internal_resistance());
+    deviface_putstring(" mOhm, drain ");
+    deviface_put_uint16(battery_get_drain());
+    deviface_putline(" uV/s");
+    deviface_putstring("charge: ");
+    deviface_put_uint16(battery_get_state_of_charge());
+    deviface_putstring("%, left: ");
+    deviface_put_uint16(battery_get_seconds_left());
+    deviface_putstring(" s, ");
+    deviface_put_uint16(battery_get_puffs_left());
+    deviface_putline(" puffs");
+}
+
+static void _command_print_coil(void) {
+    deviface_putstring("Coil: ");
+    deviface_put_uint16(coil_resistance);
+    deviface_putstring(" mOhm (sense ");
+    deviface_put_uint16(coil_sense_value);
+    deviface_putstring(", trip at ");
+    deviface_put_uint16(COIL_SHORT_SENSE_VALUE);
+    deviface_putstring("/");
+    deviface_put_uint16(coil_open_sense_value);
+    deviface_putline(")");
+}
+
+static void _command_adc_noise_reduction_on(void) {
+    adc_noise_reduction = 1;
+}
+
+static void _command_adc_noise_reduction_off(void) {
+    adc_noise_reduction = 0;
+}
+
+static const DevifaceCommand hardware_commands[] PROGMEM = {
+    {"on",          hardware_fire_on,                  "fire on"},
+    {"off",         hardware_fire_off,                 "fire off"},
+    {"bvm",         _command_measure_battery,          "measure battery voltage"},
+    {"bat",         _command_print_battery_estimation, "print battery estimation"},
+    {"coil",        _command_print_coil,               "print coil resistance"},
+    {"pwm",         _command_print_fire_duty,          "print fire duty cycle"},
+    {"pwm +",       _command_increase_fire_duty,       "fire duty cycle +10%"},
+    {"pwm -",       _command_decrease_fire_duty,       "fire duty cycle -10%"},
+    {"timeout",     _command_print_fire_timeout,       "print max. fire duration"},
+    {"timeout +",   _command_increase_fire_timeout,    "max. fire duration +1s"},
+    {"timeout -",   _command_decrease_fire_timeout,    "max. fire duration -1s"},
+    {"adc nr on",   _command_adc_noise_reduction_on,   "ADC sleep (garbles UART)"},
+    {"adc nr off",  _command_adc_noise_reduction_off,  "no ADC sleep"},
+};
+const DevifaceCommandTable hardware_deviface_commands PROGMEM = DEVIFACE_COMMAND_TABLE(hardware_commands);
+#endif
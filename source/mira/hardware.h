@@ -19,25 +19,82 @@
 #ifndef HARDWARE_H
 #define HARDWARE_H
 
-// events from the hardware module, communicated by the hw_events_queue
+// events from the hardware module, communicated by the hw_event_queue or (if urgent) by the hw_urgent_event_queue
+// (fire on/off are always urgent)
 #define HW__FIRE_ON 1
 #define HW__FIRE_OFF 2
-#define HW__BATTERY_MEASURE 3       // battery voltage in second byte of queue element
+#define HW__BATTERY_MEASURE 3       // loaded battery voltage in mV in the event value of the queue element; urgent if it's at or below BATTERY_VOLTAGE_STOP_VALUE
+#define HW__BATTERY_PROGNOSIS 4     // predicted firing time left in s in the event value (BATTERY_UNKNOWN if unknown), see \ref battery
+#define HW__COIL_FAULT 5            // the coil check at fire start has cut the MOSFET, HW_COIL_SHORT or HW_COIL_OPEN in the event value
+#define HW__FIRE_TIMEOUT 6          // the fire timeout has cut the MOSFET (urgent)
+#define HW__BATTERY_MEASURE_RESTED 7 // rested battery voltage in mV in the event value
+
+// tags of the battery measurements (see do_battery_measurement())
+#define HW_BVM_RESTED 0             // not firing, after the battery has relaxed
+#define HW_BVM_LOADED 1             // while firing
+
+// coil faults (see HW__COIL_FAULT)
+#define HW_COIL_SHORT 1             // coil resistance below HW_COIL_MIN_MILLIOHMS
+#define HW_COIL_OPEN 2              // coil resistance above HW_COIL_MAX_MILLIOHMS (or no coil at all)
+
+// Maximum fire duration in ms (default), enforced by a timer compare ISR that cuts the MOSFET
+#ifndef HW_FIRE_TIMEOUT_MS
+    #define HW_FIRE_TIMEOUT_MS 8000
+#endif
+#define HW_FIRE_TIMEOUT_MIN_MS 500
+#define HW_FIRE_TIMEOUT_MAX_MS 20000
+
+// Limits of the coil resistance (including wiring and MOSFET) checked at fire start, in mOhm. The short is decided on
+// one fast conversion (about 8 bit, the limit is about 170 counts). The open coil and the resistance are measured
+// against the internal 1.1 V reference (4 conversions, about 0.3% per count at 1 Ohm, 1.4% at 4 Ohm), based on the
+// last rested battery voltage, so the uncertainty of that (and of the internal resistance) adds.
+#define HW_COIL_MIN_MILLIOHMS 100
+#define HW_COIL_MAX_MILLIOHMS 4000
 
 #include <avr/io.h>
 #include "queue.h"
 
+#ifdef UART_ENABLED
+    #include "deviface.h"
+    // developer interface commands of the hardware module
+    extern const DevifaceCommandTable hardware_deviface_commands;
+#endif
+
 extern Queue hw_event_queue;
 
+// Queue for the hardware events that must not wait behind others, processed before the hw_event_queue
+extern Queue hw_urgent_event_queue;
+
 uint8_t hardware_init(void);
 
 void hardware_step(void);
 
+// Returns 1 if hardware_step() has nothing to do till the next event (so the main loop may sleep)
+uint8_t hardware_is_idle(void);
+
+// Returns 1 if the main loop should sleep in the ADC noise reduction mode (instead of the idle mode) since a conversion is running
+uint8_t hardware_wants_adc_noise_reduction(void);
+
 void hardware_fire_on(void);
 
 void hardware_fire_off(void);
 
-void do_battery_measurement(void);
+// Sets the duty cycle of the fire PWM in percent (100: MOSFET permanently on, the default); applies at once while firing
+void hardware_set_fire_duty(uint8_t percent);
+
+uint8_t hardware_get_fire_duty(void);
+
+// Sets the maximum fire duration in ms (clamped to HW_FIRE_TIMEOUT_MIN_MS..HW_FIRE_TIMEOUT_MAX_MS), applies from the next fire on
+void hardware_set_fire_timeout(uint16_t milliseconds);
+
+uint16_t hardware_get_fire_timeout(void);
+
+// Coil resistance in mOhm as measured by the last coil check without fault (0 if there was none yet)
+uint16_t hardware_get_coil_resistance(void);
+
+// Requests a battery measurement tagged as HW_BVM_LOADED or HW_BVM_RESTED. It's dropped if the fire state doesn't
+// match the tag when it starts or ends (firing started or stopped meanwhile).
+void do_battery_measurement(uint8_t tag);
 
 void hardware_power_down(void);
 
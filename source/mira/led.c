@@ -18,12 +18,29 @@
 
 #import "led.h"
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 #include MCUHEADER
-#ifdef UART_ENABLED
-    #include "deviface.h"
-#endif
 
 
+#if LED_DITHERING
+// compare values with 8 fractional bits (the integer part is the compare register value)
+static const uint16_t led_pwmtable[100] PROGMEM =       // created by "valuearray.py -f logarithmic -a 5 -b 255 -n 100 -x 8"
+{
+  1280,   4734,   8003,  11095,  14022,  16791,  19411,  21891,
+ 24237,  26457,  28558,  30546,  32426,  34206,  35890,  37484,
+ 38992,  40419,  41769,  43047,  44256,  45400,  46482,  47506,
+ 48475,  49393,  50260,  51082,  51859,  52594,  53290,  53948,
+ 54571,  55160,  55718,  56246,  56745,  57218,  57665,  58088,
+ 58488,  58867,  59226,  59565,  59886,  60190,  60477,  60749,
+ 61006,  61250,  61480,  61698,  61905,  62100,  62284,  62459,
+ 62625,  62781,  62929,  63069,  63202,  63327,  63446,  63558,
+ 63665,  63765,  63861,  63951,  64036,  64116,  64193,  64265,
+ 64333,  64398,  64459,  64517,  64572,  64624,  64673,  64719,
+ 64763,  64805,  64844,  64881,  64916,  64950,  64981,  65011,
+ 65039,  65066,  65091,  65115,  65138,  65159,  65179,  65199,
+ 65217,  65234,  65250,  65280
+};
+#else
 static const uint8_t led_pwmtable[100] PROGMEM =        // created by "valuearray.py -f logarithmic -a 5 -b 255 -n 100"
 {
     5,   18,   31,   43,   55,   66,   76,   86,
@@ -40,155 +57,189 @@ static const uint8_t led_pwmtable[100] PROGMEM =        // created by "valuearra
   254,  254,  254,  254,  254,  255,  255,  255,
   255,  255,  255,  255
 };
-
-
-// Commands for a LED, "instant commands" (commands that do not need a temporal duration) must have the lowest values.
-// The highest value for an instant command must be specified as HIGHEST_INSTAND_COMMAND_VALUE.
-#define COMMAND_SET_BRIGTHNESS  0
-#define COMMAND_REPEAT          1
-#define COMMAND_CALLBACK        2
-#define COMMAND_HOLD            3
-#define COMMAND_DIM_LINEAR      4
-#define HIGHEST_INSTAND_COMMAND_VALUE 2
+#endif
 
 
 void led_init_led(LED* led, uint8_t *compare_register_address) {
     led->_compare_register_address = compare_register_address;
     led_set_brightness(led, 0);
-    led_program_reset(led);
-}
-
-void led_program_reset(LED* led) {
-    led->_current_command_ix = 255;
-    led->_command_count = 0;
-    led->_step_count = 0;
-}
-
-LEDCommand* _get_command_to_add(LED* led) {
-    if (led->_command_count < _LED_MAX_COMMAND_COUNT) {
-        ++(led->_command_count);
-    } else {
-        #ifdef UART_ENABLED
-        deviface_putstring("ERROR: too much LED commands");
-        #endif
-    }
-    return led->_commands + led->_command_count - 1;
-}
-
-void led_program_add_brightness(LED* led, uint8_t brightness) {
-    LEDCommand* command = _get_command_to_add(led);
-    command->cmd = COMMAND_SET_BRIGTHNESS;
-    command->brightness.value = brightness;
-}
-
-void led_program_add_hold(LED* led, uint8_t duration) {
-    LEDCommand* command = _get_command_to_add(led);
-    command->cmd = COMMAND_HOLD;
-    command->hold.duration = duration;
-}
-
-void led_program_repeat(LED* led, uint8_t from_step, uint8_t number) {
-    LEDCommand* command = _get_command_to_add(led);
-    command->cmd = COMMAND_REPEAT;
-    command->repeat.index = from_step - 1;
-    command->repeat.number = number;
-    command->repeat.counter = 0;
-}
-
-void led_program_add_linear_dim(LED* led, uint8_t brightness, uint8_t ramp_duration) {
-    LEDCommand* command = _get_command_to_add(led);
-    command->cmd = COMMAND_DIM_LINEAR;
-    command->dim_linear._ramp_duration = ramp_duration;
-    command->dim_linear._target_brightness = brightness;
-}
-
-void led_program_callback(LED* led, LedProgramCallback callback_fct) {
-    LEDCommand* command = _get_command_to_add(led);
-    command->cmd = COMMAND_CALLBACK;
-    command->callback._callback = callback_fct;
 }
 
 void _led_set_brightness(LED* led, uint8_t brightness) {
     if (brightness > 99) {
         brightness = 99;
     }
+#if LED_DITHERING
+    uint16_t compare = pgm_read_word(& led_pwmtable[99 - brightness]);
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {     // (read by led_dither_all() in the timer ISR)
+        led->_compare = compare >> 8;
+        led->_compare_fraction = compare & 0xFF;
+        *(led->_compare_register_address) = led->_compare;
+    }
+#else
     *(led->_compare_register_address) = pgm_read_byte(& led_pwmtable[99 - brightness]);
+#endif
     led->_current_brightness = brightness;
 }
 
-void _next_command(LED* led) {
+static inline uint8_t _argument(LED* led, uint8_t n) {
+    return pgm_read_byte(led->_pattern + led->_pc + n);
+}
+
+/**
+ * Executes the instructions from the current one on until one that takes time (HOLD, DIM) or the end of the pattern.
+ */
+void _run_instant_instructions(LED* led) {
     led->_step_count = 0;
     do {
-        ++(led->_current_command_ix);
-        if (led->_current_command_ix == led->_command_count) {
-            // no command left, LED program finished
-            led_program_reset(led);
-            return;
-        } else {
-            // check for the next command
-            if (led->_commands[led->_current_command_ix].cmd > HIGHEST_INSTAND_COMMAND_VALUE) {
-                // not an "instant" command -> will be handled in the led_step function
-                return;
+        switch (_argument(led, 0)) {
+            case LED_OP_SET: {
+                _led_set_brightness(led, _argument(led, 1));
+                led->_pc += 2;
+                break;
             }
-            // "instant" commands (handle commands that have no temporal duration here, not in the led_step function)
-            switch (led->_commands[led->_current_command_ix].cmd) {
-                case COMMAND_SET_BRIGTHNESS: {
-                    _led_set_brightness(led, led->_commands[led->_current_command_ix].brightness.value);
-                    break;
-                }
-                case COMMAND_REPEAT: {
-                    LEDCommand* cmd = &led->_commands[led->_current_command_ix];
-                    if (cmd->repeat.number == 0 || cmd->repeat.counter++ < cmd->repeat.number) {
-                        led->_current_command_ix = cmd->repeat.index;
-                    } else {
-                        // else, go on with the next command...
-                        cmd->repeat.counter = 0; // ...but set the counter back which is needed if we have nested repeats
+            case LED_OP_REPEAT:
+            case LED_OP_REPEAT_PARAM: {
+                uint8_t count = _argument(led, 3);
+                if (_argument(led, 0) == LED_OP_REPEAT_PARAM) {
+                    count = led->_params[count];
+                    if (count == 0) {
+                        count = 1;
                     }
-                    break;
                 }
-                case COMMAND_CALLBACK: {
-                    led->_commands[led->_current_command_ix].callback._callback(led);
+                uint8_t* counter = &led->_loop_counters[_argument(led, 2)];
+                if (count == 0 || ++(*counter) < count) {
+                    led->_pc = _argument(led, 1);
+                } else {
+                    // go on with the next instruction, but set the counter back which is needed if we have nested repeats
+                    *counter = 0;
+                    led->_pc += 4;
+                }
+                break;
+            }
+            case LED_OP_STOP_IF_ZERO: {
+                if (led->_params[_argument(led, 1)] == 0) {
+                    led->_pattern = 0;
+                    return;
+                }
+                led->_pc += 2;
+                break;
+            }
+            case LED_OP_CALLBACK: {
+                if (led->_callback) {
+                    led->_callback(led);
                 }
+                led->_pc += 1;
+                break;
+            }
+            case LED_OP_HOLD: {
+                // takes time -> will be handled in the _led_step function when it's over
+                led->_wait = _argument(led, 1) ? _argument(led, 1) : 1;
+                return;
+            }
+            case LED_OP_DIM: {
+                // takes time -> will be handled in the _led_step function each tick
+                led->_wait = 1;
+                return;
+            }
+            default: {
+                // LED_OP_END: pattern finished
+                led->_pattern = 0;
+                return;
             }
         }
     } while (1);
 }
 
-void led_start_program(LED* led) {
-    _next_command(led);
+void led_start_pattern(LED* led, const uint8_t* pattern, uint8_t p0, uint8_t p1, LedPatternCallback callback) {
+    led->_pattern = pattern;
+    led->_pc = 0;
+    led->_params[0] = p0;
+    led->_params[1] = p1;
+    led->_loop_counters[0] = 0;
+    led->_loop_counters[1] = 0;
+    led->_callback = callback;
+    _run_instant_instructions(led);
 }
 
-void led_step(LED* led) {
-    LEDCommand* command = &(led->_commands[led->_current_command_ix].cmd);
+/**
+ * Runs the pattern of the LED for the tick its _wait has run out.
+ */
+static void _led_step(LED* led) {
     ++(led->_step_count);
-    switch (command->cmd) {
-        case COMMAND_HOLD: {
-            if (command->hold.duration == led->_step_count) {   // if we hold "long enough", go to the next command
-                _next_command(led);
-            };                                                  // otherwise, do nothing
+    switch (_argument(led, 0)) {
+        case LED_OP_HOLD: {
+            led->_pc += 2;                          // we held long enough, go to the next instruction
+            _run_instant_instructions(led);
             break;
         }
-        case COMMAND_DIM_LINEAR: {
+        case LED_OP_DIM: {
+            uint8_t target = _argument(led, 1);
+            uint8_t duration = _argument(led, 2);
+            if (duration == 0 || led->_step_count == duration) {
+                _led_set_brightness(led, target);   // we reached the final step, set the final brightness...
+                led->_pc += 3;
+                _run_instant_instructions(led);     // ... and go to the next instruction
+                break;
+            }
+            uint8_t up = (target >= led->_current_brightness);
             if (led->_step_count == 1) {
-                    command->dim_linear._start_brightness = led->_current_brightness;
+                // start of the ramp: the only division, the error starts at one half for the rounding
+                // (start + delta * step / duration + 0.5, rounded down)
+                uint8_t delta = up ? target - led->_current_brightness : led->_current_brightness - target;
+                led->_ramp_step = delta / duration;
+                led->_ramp_remainder = delta % duration;
+                led->_ramp_error = up ? duration / 2 : (duration - 1) / 2;
             }
-            if (command->dim_linear._ramp_duration == 0 || led->_step_count == command->dim_linear._ramp_duration) {
-                _led_set_brightness(led, command->dim_linear._target_brightness);   // we reached the final step, set the final brightness...
-                _next_command(led);                                                 // ... and go to the next command
+            uint8_t step = led->_ramp_step;
+            if (led->_ramp_error >= duration - led->_ramp_remainder) {
+                led->_ramp_error -= duration - led->_ramp_remainder;
+                ++step;
             } else {
-                  float a = command->dim_linear._target_brightness - command->dim_linear._start_brightness;
-                  float b = (float)command->dim_linear._ramp_duration;
-                  int8_t c = (int8_t)(
-                       (a / b) * led->_step_count + 0.5 + command->dim_linear._start_brightness
-                  );
-                  _led_set_brightness(led, c);
+                led->_ramp_error += led->_ramp_remainder;
             }
+            _led_set_brightness(led, up ? led->_current_brightness + step : led->_current_brightness - step);
+            led->_wait = 1;
             break;
         }
     }
 }
 
+uint8_t led_step_all(LED* leds, uint8_t count, uint8_t ticks) {
+    uint8_t wait = 0;
+    LED* end = leds + count;
+    for (; leds != end; ++leds) {
+        if (!leds->_pattern) {
+            continue;
+        }
+        if (leds->_wait > ticks) {
+            leds->_wait -= ticks;
+        } else {
+            _led_step(leds);
+            if (!leds->_pattern) {
+                continue;
+            }
+        }
+        if (wait == 0 || leds->_wait < wait) {
+            wait = leds->_wait;
+        }
+    }
+    return wait;
+}
+
+#if LED_DITHERING
+void led_dither_all(LED* leds, uint8_t count) {
+    LED* end = leds + count;
+    for (; leds != end; ++leds) {
+        uint8_t error = leds->_dither_error;
+        leds->_dither_error += leds->_compare_fraction;
+        // one more on each carry of the error (a fraction of 0 never carries, so 255 is never exceeded)
+        *(leds->_compare_register_address) = leds->_compare + (leds->_dither_error < error);
+    }
+}
+#endif
+
 void led_set_brightness(LED* led, uint8_t brightness) {
-    led_program_reset(led);
+    led->_pattern = 0;
     _led_set_brightness(led, brightness);
 }
@@ -21,77 +21,136 @@
 
 #include <avr/io.h>
 
-#define _LED_MAX_COMMAND_COUNT 12
+/*
+ * Dithering: the brightnesses are mapped to compare values with 8 fractional bits, and led_dither_all() (called on
+ * each PWM period) spreads the fraction over the periods by an error accumulator. That gives fine steps at low
+ * brightnesses where the 8 bit compare values of the logarithmic table are too coarse.
+ */
+#ifndef LED_DITHERING
+    #define LED_DITHERING 1
+#endif
 
 typedef struct LED LED;
-typedef struct LEDCommand LEDCommand;
-
-typedef void (*LedProgramCallback)(LED*);
-
-struct LEDCommand {
-    uint8_t cmd;
-    union {
-        struct {
-            uint8_t a;
-            uint8_t b;
-            uint8_t c;
-        } generic;
-        struct {
-            uint8_t value;
-            uint8_t _dead_;
-            uint8_t _dead__;
-        } brightness;
-        struct {
-            uint8_t index;
-            uint8_t number;
-            uint8_t counter;
-        } repeat;
-        struct {
-            uint8_t duration;   // 0 for infinity
-            uint8_t _dead_;
-            uint8_t _dead__;
-        } hold;
-        struct {
-            uint8_t _ramp_duration;
-            uint8_t _start_brightness;
-            uint8_t _target_brightness;
-        } dim_linear;
-        struct {
-            LedProgramCallback _callback;
-        } callback;
-    };
-};
+
+typedef void (*LedPatternCallback)(LED*);
+
+/*
+ * LED patterns are byte code programs in the flash (PROGMEM), usually compiled from a pattern description by the
+ * LED pattern compiler (site_scons/site_tools/ledpattern.py, see there for the description language). The byte
+ * code is written with the macros below. Each instruction is an opcode followed by its arguments (one byte each);
+ * the compiler's instruction lengths must match these macros.
+ *
+ * HOLD and DIM take their time (steps of led_step(), i.e. UI ticks), all other instructions are executed at once.
+ * The repeat instructions jump back to the pattern offset "target" until the instructions have been run "count"
+ * times in total (0 for forever), using the loop counter "slot" (each repeat of a pattern needs a slot of its own).
+ */
+#define LED_OP_END              0
+#define LED_OP_SET              1   // brightness
+#define LED_OP_DIM              2   // brightness, duration
+#define LED_OP_HOLD             3   // duration
+#define LED_OP_REPEAT           4   // target, slot, count
+#define LED_OP_REPEAT_PARAM     5   // target, slot, parameter index (the parameter is the count, 0 is taken as 1)
+#define LED_OP_STOP_IF_ZERO     6   // parameter index
+#define LED_OP_CALLBACK         7
+
+#define LED_END                                 LED_OP_END
+#define LED_SET(brightness)                     LED_OP_SET, (brightness)
+#define LED_DIM(brightness, duration)           LED_OP_DIM, (brightness), (duration)
+#define LED_HOLD(duration)                      LED_OP_HOLD, (duration)
+#define LED_REPEAT(target, slot, count)         LED_OP_REPEAT, (target), (slot), (count)
+#define LED_REPEAT_PARAM(target, slot, param)   LED_OP_REPEAT_PARAM, (target), (slot), (param)
+#define LED_STOP_IF_ZERO(param)                 LED_OP_STOP_IF_ZERO, (param)
+#define LED_CALLBACK                            LED_OP_CALLBACK
+
+#define LED_PATTERN_PARAMS  2   // number of parameters passed to a pattern
+#define LED_PATTERN_LOOPS   2   // number of repeat instructions in a pattern
 
 struct LED {
     uint8_t* _compare_register_address;
     uint8_t _step_count;
     uint8_t _current_brightness;
-    uint8_t _current_command_ix; // [0.._LED_MAX_COMMAND_COUNT-1] as index for the command, 255 for "no command"
-    uint8_t _command_count;
-    LEDCommand _commands[_LED_MAX_COMMAND_COUNT];
+    const uint8_t* _pattern;    // the running pattern (in the flash), 0 for "no pattern"
+    uint8_t _pc;                // offset of the current instruction within the pattern
+    uint8_t _wait;              // ticks till the pattern changes the LED next (1..255, while a pattern is running)
+    uint8_t _params[LED_PATTERN_PARAMS];
+    uint8_t _loop_counters[LED_PATTERN_LOOPS];
+    LedPatternCallback _callback;
+    // linear dim (DDA): each step moves the brightness by _ramp_step, plus one whenever the error accumulator
+    // (the fraction in 1/_ramp_duration) overflows by adding _ramp_remainder
+    uint8_t _ramp_step;
+    uint8_t _ramp_remainder;
+    uint8_t _ramp_error;
+#if LED_DITHERING
+    uint8_t _compare;           // integer part of the compare value
+    uint8_t _compare_fraction;  // fractional part of the compare value (1/256)
+    uint8_t _dither_error;
+#endif
 };
 
 
 
+/**
+ * A software PWM output for an LED channel without a hardware compare unit. The LED writes its compare value to
+ * "compare" (same meaning as for the inverting hardware PWM: 255 is off) and led_soft_pwm_step() is called on each
+ * timer overflow. It spreads the on time over the overflows (first order sigma-delta), so the PWM frequency is low:
+ * fine for an extra indicator LED, low brightnesses flicker visibly.
+ */
+typedef struct {
+    uint8_t compare;
+    uint8_t _error;
+} LedSoftPwm;
+
+/**
+ * Returns 1 if the software PWM output is on for the next timer period.
+ */
+static inline uint8_t led_soft_pwm_step(LedSoftPwm* pwm) {
+    uint8_t error = pwm->_error;
+    pwm->_error += (uint8_t) ~pwm->compare;
+    return pwm->_error < error;     // carry
+}
+
+/**
+ * Initializes the LED channel, compare_register_address is the compare register of a hardware PWM or the compare
+ * value of a LedSoftPwm.
+ */
 void led_init_led(LED* led, uint8_t* compare_register_address);
 
-void led_step(LED* led);
-
+/**
+ * Advances the patterns of all count LEDs of the array by the given number of ticks and returns the number of ticks
+ * till the next change of any of them (0 if no pattern is running). Since nothing happens in between, the caller
+ * may skip the ticks till then, but must not advance further in one call. With 0 ticks it just returns the ticks
+ * till the next change (e.g. after a pattern has been started).
+ *
+ * The pattern functions must be called from one context only (they are not synchronized), led_dither_all() may
+ * run in an ISR.
+ */
+uint8_t led_step_all(LED* leds, uint8_t count, uint8_t ticks);
+
+/**
+ * Sets the brightness (0..99), a running pattern is stopped.
+ */
 void led_set_brightness(LED* led, uint8_t brightness);
 
-void led_program_reset(LED* led);
-
-void led_program_add_brightness(LED* led, uint8_t brightness);
-
-void led_program_add_linear_dim(LED* led, uint8_t brightness, uint8_t ramp_duration);
-
-void led_program_add_hold(LED* led, uint8_t duration);
-
-void led_program_repeat(LED* led, uint8_t from_step, uint8_t number);
-
-void led_program_callback(LED* led, LedProgramCallback callback_fct);
-
-void led_start_program(LED* led);
+#if LED_DITHERING
+/**
+ * Dithers the compare values of all count LEDs of the array, to be called once per PWM period (with the compare
+ * registers double buffered: before the period starts).
+ */
+void led_dither_all(LED* leds, uint8_t count);
+
+/**
+ * Returns 1 if the LED needs led_dither_all() (its compare value has a fraction).
+ */
+static inline uint8_t led_is_dithering(LED* led) {
+    return led->_compare_fraction != 0;
+}
+#endif
+
+/**
+ * Starts the pattern (in the flash) with the parameters p0 and p1. The callback is called by the CALLBACK
+ * instruction of the pattern (0 if the pattern has none). A running pattern is replaced.
+ */
+void led_start_pattern(LED* led, const uint8_t* pattern, uint8_t p0, uint8_t p1, LedPatternCallback callback);
 
 #endif // LED_H
 
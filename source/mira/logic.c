@@ -17,10 +17,14 @@
 */
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 #include <util/delay.h>
 #include "logic.h"
 #include "hardware.h"
 #include "ui.h"
+#include "statemachine.h"
+#include "profile.h"
+#include "battery.h"
 #include MCUHEADER
 #ifdef UART_ENABLED
     #include "deviface.h"
@@ -31,22 +35,387 @@
  * Global variables
  */
 static uint8_t local_bools = 0;
-#define LB_HW_IS_FIRING   1     // if true, hardware is currently firing
 #define LB_PRINT_BVMS     2     // if true, the battery voltage is printed each time its received (set via deviface)
 
-uint8_t battery_voltage_under_load = 0; //external
-uint8_t global_state = GS_ON;           //external
+uint16_t battery_voltage_under_load = 0; //external
+uint16_t battery_seconds_left = BATTERY_UNKNOWN; //external
 
-void logic_loop (void) {
-    static uint16_t logic_main_cycle_counter = 0;           // contineously counts the cycles of the main loop and just overflows at its value range end back to 0
+// Battery measurement schedule, in 50ms pulses since firing started or stopped (or the device was switched on):
+// while firing, densely while the sag develops and then sparsely; while not firing, once after the battery has
+// relaxed. There are no pulses while sleeping.
+#define BVM_PUFF_START_PULSES   6       // while firing, every pulse in the first 300ms...
+#define BVM_FIRING_PULSES       8       // ...and then every 400ms
+#define BVM_REST_PULSES         40      // while not firing, once after 2s
+#define BVM_NONE                0xFFFF  // no further measurement in this phase
+static uint16_t bvm_phase_pulses = 0;                   // pulses since the start of the phase
+static uint16_t bvm_next_pulse = BVM_REST_PULSES;       // phase pulse of the next measurement
+
+/**
+ * Starts the battery measurement schedule of a new phase (firing or not).
+ */
+static void _start_battery_measurement_phase(uint8_t firing) {
+    bvm_phase_pulses = 0;
+    bvm_next_pulse = firing ? 1 : BVM_REST_PULSES;
+}
+
+/**
+ * Advances the battery measurement schedule by the given number of pulses and requests the measurement when it's due.
+ */
+static void _schedule_battery_measurement(uint8_t pulses) {
+    if (bvm_next_pulse == BVM_NONE) {
+        return;
+    }
+    bvm_phase_pulses += pulses;
+    if (bvm_phase_pulses < bvm_next_pulse) {
+        return;
+    }
+    if (logic_device_is_in(DS_FIRING)) {
+        do_battery_measurement(HW_BVM_LOADED);
+        bvm_next_pulse = bvm_phase_pulses + (bvm_phase_pulses < BVM_PUFF_START_PULSES ? 1 : BVM_FIRING_PULSES);
+    } else {
+        do_battery_measurement(HW_BVM_RESTED);
+        bvm_next_pulse = BVM_NONE;
+    }
+}
+
+/*
+ * Device state machine (the tables and the events besides the UI events are in logic_states.h)
+ */
+static uint8_t coil_fault = 0;      // HW_COIL_SHORT or HW_COIL_OPEN of the last HW__COIL_FAULT event
+
+static void _enter_firing(void) {
+    hardware_fire_on();
+}
+
+static void _exit_firing(void) {
+    hardware_fire_off();
+}
+
+static void _enter_forced_off(void) {
+    ui_switch_off_forced();
+}
+
+static void _fire_timed_out(void) {
+    ui_fire_timeout();
+}
+
+static void _enter_coil_fault(void) {
+    ui_coil_fault(coil_fault);  // (shown when firing has been switched off by the exit of DS_FIRING)
+}
+
+static void _enter_sleeping(void) {
+    #ifdef UART_ENABLED
+    deviface_putline("DOWN");
+    #endif
+    hardware_fire_off();    // whatever the hardware is doing (it may fire via the deviface)
+    // (the modules are powered down by the main loop after the event processing since that clears the queues)
+}
+
+static void _power_up(void) {
+    // user asked to switch on the device again... we wake up
+    hardware_power_up();
+    ui_power_up();
+    _start_battery_measurement_phase(0);
     #ifdef UART_ENABLED
-    static uint16_t last_logic_cycle_value = 0;             // stores the logic cycle count at each 50 ms event and is used to calc the delta
-    static uint16_t last_logic_cycles_per_50ms_event = 0;   // stores the number of cycles that happened between the two last 50ms events
-    static uint16_t min_logic_cycles_per_50ms_event = 0;    // stores the minimum value of the above variable throughout the whole uptime
+    deviface_putline("DEVICE UP");
     #endif
-    static uint8_t pulse_counter_for_battery_voltage_measurement = 0;   // counts 50ms events to trigger battery voltage measurements in regular intervals
+}
 
+#include "logic_states.h"
 
+static StateMachine device_state_machine;
+
+uint8_t logic_device_is_in(uint8_t state) {
+    return statemachine_is_in(&device_state_machine, state);
+}
+
+#if defined(UART_ENABLED) && defined(MCU_FREE_RUNNING_TIMER)
+    // measure how often and how long the main loop is awake (for development purposes only)
+    #define LOGIC_LOOP_STATISTICS
+#endif
+
+#ifdef LOGIC_LOOP_STATISTICS
+#define LOOP_STATISTICS_PULSES 20                       // number of 50ms pulses per statistics period (1s)
+static uint8_t loop_statistics_pulse_counter = 0;       // counts the 50ms pulses of the current statistics period
+static uint16_t wakeup_counter = 0;                     // counts the wakeups of the current statistics period
+static uint32_t awake_ticks = 0;                        // free running timer ticks spent awake in the current statistics period
+static uint32_t asleep_ticks = 0;                       // free running timer ticks spent sleeping in the current statistics period
+static uint16_t last_wakeup_timestamp = 0;              // free running timer value at the last wakeup
+static uint16_t wakeups_per_second = 0;                 // result of the last statistics period
+static uint16_t awake_permille = 0;                     // result of the last statistics period
+#endif
+/**
+ * Processes a single UI event while the device is on (not awakening).
+ * Returns 1 if the device has been switched off. All further pending UI events are obsolete then.
+ */
+static uint8_t _process_ui_event(QueueElement* e) {
+    if (e->bytes.a == UI__50MS_PULSE) {
+        // 1) close the loop statistics period every second (for development purposes only)
+        #ifdef LOGIC_LOOP_STATISTICS
+        loop_statistics_pulse_counter += e->bytes.b;
+        if (loop_statistics_pulse_counter >= LOOP_STATISTICS_PULSES) {
+            loop_statistics_pulse_counter = 0;
+            wakeups_per_second = wakeup_counter;
+            awake_permille = (asleep_ticks == 0) ? 1000 : (awake_ticks * 1000) / (awake_ticks + asleep_ticks);
+            wakeup_counter = 0;
+            awake_ticks = 0;
+            asleep_ticks = 0;
+        }
+        #endif
+
+        // 2) count the firing time and trigger the battery voltage measurements (a congested queue collapses pulses
+        //    into one event)
+        if (logic_device_is_in(DS_FIRING)) {
+            battery_fired(e->bytes.b);
+        }
+        _schedule_battery_measurement(e->bytes.b);
+        return 0;
+    }
+    // all other UI events go to the device state machine
+    statemachine_dispatch(&device_state_machine, e->bytes.a);
+    return logic_device_is_in(DS_SLEEPING);
+}
+
+/**
+ * Processes a single hardware event.
+ */
+static void _process_hw_event(QueueElement* e) {
+    if (e->bytes.a == HW__FIRE_ON) {
+        _start_battery_measurement_phase(1);
+        ui_fire_is_on();
+    }
+    else if (e->bytes.a == HW__FIRE_OFF) {
+        _start_battery_measurement_phase(0);
+        ui_fire_is_off();
+    }
+    else if (e->bytes.a == HW__BATTERY_MEASURE) {
+        if (logic_device_is_in(DS_FIRING)) {
+            battery_voltage_under_load = e->event.value;
+            // check if the battery voltage has dropped so low that we have to block firing
+            if (battery_voltage_under_load <= BATTERY_VOLTAGE_STOP_VALUE) {
+                statemachine_dispatch(&device_state_machine, DEV_EV_UNDER_VOLTAGE);
+            }
+        }
+        #ifdef UART_ENABLED
+        if (local_bools & LB_PRINT_BVMS) {
+            deviface_putstring("BVM: ");
+            deviface_put_uint16(e->event.value);
+            deviface_putline(" mV");
+        }
+        #endif
+    }
+    else if (e->bytes.a == HW__BATTERY_MEASURE_RESTED) {
+        #ifdef UART_ENABLED
+        if (local_bools & LB_PRINT_BVMS) {
+            deviface_putstring("BVM rested: ");
+            deviface_put_uint16(e->event.value);
+            deviface_putline(" mV");
+        }
+        #endif
+    }
+    else if (e->bytes.a == HW__FIRE_TIMEOUT) {
+        statemachine_dispatch(&device_state_machine, DEV_EV_FIRE_TIMEOUT);
+    }
+    else if (e->bytes.a == HW__COIL_FAULT) {
+        coil_fault = e->event.value;
+        statemachine_dispatch(&device_state_machine, DEV_EV_COIL_FAULT);
+    }
+    else if (e->bytes.a == HW__BATTERY_PROGNOSIS) {
+        battery_seconds_left = e->event.value;
+        #ifdef UART_ENABLED
+        if (local_bools & LB_PRINT_BVMS) {
+            deviface_putstring("Left: ");
+            deviface_put_uint16(e->event.value);
+            deviface_putline(" s");
+        }
+        #endif
+    }
+}
+
+/**
+ * Processes all pending events of the urgent queues (UI and HW), the UI events first.
+ * Returns 1 if the device has to be switched off.
+ */
+static void _process_hw_urgent_events(void) {
+    QueueElement* e;
+    uint8_t n;
+    while ((n = queue_get_read_elements(&hw_urgent_event_queue, &e)) > 0) {
+        uint8_t i;
+        for (i = 0; i < n; i++) {
+            _process_hw_event(e + i);
+        }
+        queue_commit_read_elements(&hw_urgent_event_queue, n);
+    }
+}
+
+static uint8_t _process_urgent_events(void) {
+    QueueElement* e;
+    uint8_t n;
+    uint8_t switch_off = 0;
+    while (!switch_off && (n = queue_get_read_elements(&ui_urgent_event_queue, &e)) > 0) {
+        uint8_t processed = 0;
+        while (!switch_off && processed < n) {
+            switch_off = _process_ui_event(e + processed++);
+            // (HW events created while processing, e.g. fire off, right away, so the HW urgent queue only has to hold
+            // those of a single transition)
+            _process_hw_urgent_events();
+        }
+        queue_commit_read_elements(&ui_urgent_event_queue, processed);
+    }
+    _process_hw_urgent_events();
+    return switch_off;
+}
+
+#ifdef UART_ENABLED
+/*
+ * Developer interface commands of the logic module
+ */
+static void _command_print_battery_voltage(void) {
+    deviface_putstring("Battery voltage under load: ");
+    deviface_put_uint16(battery_voltage_under_load);
+    deviface_putline(" mV");
+}
+
+static void _command_print_bvms_on(void) {
+    local_bools |= LB_PRINT_BVMS;
+}
+
+static void _command_print_bvms_off(void) {
+    local_bools &= ~LB_PRINT_BVMS;
+}
+
+#ifdef LOGIC_LOOP_STATISTICS
+static void _command_print_loop_statistics(void) {
+    deviface_putstring("Wakeups per second: ");
+    deviface_put_uint16(wakeups_per_second);
+    deviface_putstring(", awake: ");
+    deviface_put_uint16(awake_permille);
+    deviface_putline(" permille");
+}
+#endif
+
+static void _command_print_queue_statistics(void) {
+    deviface_put_queue_statistics("ui", &ui_event_queue);
+    deviface_put_queue_statistics("hw", &hw_event_queue);
+    deviface_put_queue_statistics("ui!", &ui_urgent_event_queue);
+    deviface_put_queue_statistics("hw!", &hw_urgent_event_queue);
+    ui_print_queue_info();
+}
+
+static void _command_reset_queue_statistics(void) {
+    queue_reset_statistics(&ui_event_queue);
+    queue_reset_statistics(&hw_event_queue);
+    queue_reset_statistics(&ui_urgent_event_queue);
+    queue_reset_statistics(&hw_urgent_event_queue);
+    ui_reset_queue_statistics();
+}
+
+#ifdef QUEUE_LATENCY_STATISTICS
+static void _command_print_queue_latencies(void) {
+    deviface_put_queue_latency_header();
+    deviface_put_queue_latency_statistics("ui", &ui_event_queue);
+    deviface_put_queue_latency_statistics("hw", &hw_event_queue);
+    deviface_put_queue_latency_statistics("ui!", &ui_urgent_event_queue);
+    deviface_put_queue_latency_statistics("hw!", &hw_urgent_event_queue);
+    ui_print_queue_latency_info();
+}
+
+static void _command_reset_queue_latencies(void) {
+    queue_reset_latency_statistics(&ui_event_queue);
+    queue_reset_latency_statistics(&hw_event_queue);
+    queue_reset_latency_statistics(&ui_urgent_event_queue);
+    queue_reset_latency_statistics(&hw_urgent_event_queue);
+    ui_reset_queue_latency_statistics();
+}
+#endif
+
+static const DevifaceCommand logic_commands[] PROGMEM = {
+    {"bv",          _command_print_battery_voltage,     "print battery voltage"},
+    {"p bvm on",    _command_print_bvms_on,             "print each measurement"},
+    {"p bvm off",   _command_print_bvms_off,            "stop printing measurements"},
+    #ifdef LOGIC_LOOP_STATISTICS
+    {"cyc",         _command_print_loop_statistics,     "print wakeups, awake time"},
+    #endif
+    {"qs",          _command_print_queue_statistics,    "print queue fill statistics"},
+    {"qs reset",    _command_reset_queue_statistics,    "reset queue fill statistics"},
+    #ifdef QUEUE_LATENCY_STATISTICS
+    {"ql",          _command_print_queue_latencies,     "print queue wait times"},
+    {"ql reset",    _command_reset_queue_latencies,     "reset queue wait times"},
+    #endif
+};
+static const DevifaceCommandTable logic_deviface_commands PROGMEM = DEVIFACE_COMMAND_TABLE(logic_commands);
+
+// All developer interface commands, looked up in this order
+static const DevifaceCommandTable* const deviface_command_tables[] PROGMEM = {
+    &hardware_deviface_commands,
+    &ui_deviface_commands,
+    &logic_deviface_commands,
+    #ifdef PROFILING
+    &profile_deviface_commands,
+    #endif
+};
+#define DEVIFACE_COMMAND_TABLE_COUNT (sizeof(deviface_command_tables) / sizeof(deviface_command_tables[0]))
+#endif
+
+/**
+ * Sends the MCU to sleep (idle mode) if there is nothing to do till the next interrupt.
+ *
+ * The check is done with disabled interrupts, and mcu_idle_till_interrupt() enables them again
+ * atomically with going to sleep. So an ISR that produces work after the check wakes us up
+ * immediately instead of being left unprocessed till the next interrupt.
+ */
+static void _sleep_if_idle(void) {
+    cli();
+    if (
+        queue_get_unread_count(&ui_urgent_event_queue) == 0
+        && queue_get_unread_count(&hw_urgent_event_queue) == 0
+        && queue_get_unread_count(&ui_event_queue) == 0
+        && queue_get_unread_count(&hw_event_queue) == 0
+        && ui_is_idle()
+        && hardware_is_idle()
+        #ifdef UART_ENABLED
+        && uart_str_complete == 0
+        #endif
+    ) {
+        #ifdef LOGIC_LOOP_STATISTICS
+        uint16_t sleep_timestamp = MCU_FREE_RUNNING_TIMER;  // (interrupts are disabled)
+        awake_ticks += (uint16_t)(sleep_timestamp - last_wakeup_timestamp);
+        #endif
+        if (hardware_wants_adc_noise_reduction()) {
+            mcu_adc_noise_reduction_till_interrupt();   // (the free running timer pauses as well)
+        } else {
+            mcu_idle_till_interrupt();
+        }
+        #ifdef LOGIC_LOOP_STATISTICS
+        last_wakeup_timestamp = mcu_read_free_running_timer();
+        asleep_ticks += (uint16_t)(last_wakeup_timestamp - sleep_timestamp);
+        ++wakeup_counter;
+        #endif
+    } else {
+        sei();
+    }
+}
+
+uint8_t logic_wants_pulses(void) {
+    #ifdef LOGIC_LOOP_STATISTICS
+    return 1;   // (the statistics period is counted in pulses)
+    #else
+    return bvm_next_pulse != BVM_NONE || logic_device_is_in(DS_FIRING);
+    #endif
+}
+
+uint8_t logic_init(void) {
+    statemachine_init(
+        &device_state_machine,
+        device_states,
+        device_transitions,
+        device_transition_index,
+        DS_IDLE
+    );
+    return 0;
+}
+
+void logic_loop (void) {
     #ifdef UART_ENABLED
     deviface_putline("FogDrive  Copyright (C) 2016, the FogDrive Project");
     deviface_putline("This program is free software and comes with ABSOLUTELY NO WARRANTY.");
@@ -57,163 +426,68 @@ void logic_loop (void) {
     // lets enter the main loop
 
     while(1) {
+        PROFILE_BEGIN(PROF_UI_INPUT_STEP);
         ui_input_step();    // the user interface gets its cycle
+        PROFILE_END(PROF_UI_INPUT_STEP);
+        PROFILE_BEGIN(PROF_HARDWARE_STEP);
         hardware_step();    // the hardware gets its cycle
+        PROFILE_END(PROF_HARDWARE_STEP);
 
-        if (global_state == GS_AWAKENING) {
+        QueueElement* e;
+        uint8_t n;
+        if (logic_device_is_in(DS_AWAKENING)) {
             // If the device is "waking up"...
             // (Means, an interrupt has stopped the power down mode but we have not received a switch-on command from the UI yet.)
-            QueueElement* e = queue_get_read_element(&ui_event_queue);
-            // We just check for the very next UI event that is coming...
-            if (e != 0) {
-                if (e->bytes.a == UI__SWITCH_ON) {
-                    // user asked to switch on the device again... we wake up
-                    hardware_power_up();
-                    ui_power_up();
-                    global_state = GS_ON;
-                    #ifdef UART_ENABLED
-                    deviface_putline("DEVICE UP");
-                    #endif
-                } else if(e->bytes.a == UI__ABORT_AWAKENING) {
-                    // no switch-on action by the user, the device goes to sleep again
-                    #ifdef UART_ENABLED
-                    deviface_putline("DOWN AGAIN");
-                    #endif
-                    mcu_power_down_till_pin_change(); // go to sleep
-                }
+            // We just wait for the next switch-on or abort event, the state machine ignores all other UI events.
+            while (logic_device_is_in(DS_AWAKENING) && (e = queue_get_read_element(&ui_event_queue)) != 0) {
+                uint8_t event = e->bytes.a;
+                queue_commit_read(&ui_event_queue);
+                statemachine_dispatch(&device_state_machine, event);
             }
         }
         else
         {
             // The device on (not awakening)
-            // process UI event
-            QueueElement* e = queue_get_read_element(&ui_event_queue);
-            if (e != 0) {
-                if (e->bytes.a == UI__FIRE_BUTTON_PRESSED) {
-                    hardware_fire_on();
-                }
-                if (e->bytes.a == UI__FIRE_BUTTON_RELEASED) {
-                    hardware_fire_off();
-                }
-                if (e->bytes.a == UI__SWITCH_OFF) {
-                    #ifdef UART_ENABLED
-                    deviface_putline("DOWN");
-                    #endif
-                    hardware_fire_off();
-                    hardware_power_down();
-                    ui_power_down();
-                    mcu_power_down_till_pin_change(); // go to sleep
-                    global_state = GS_AWAKENING;
-                    continue;
-                }
-                if (e->bytes.a == UI__50MS_PULSE) {
-                    // 1) do the main cycle time measurement (for development purposes only)
-                    #ifdef UART_ENABLED
-                    if (last_logic_cycle_value < logic_main_cycle_counter) {
-                        // no overflow
-                        last_logic_cycles_per_50ms_event = logic_main_cycle_counter - last_logic_cycle_value;
-                        if (min_logic_cycles_per_50ms_event > last_logic_cycles_per_50ms_event) {
-                            min_logic_cycles_per_50ms_event = last_logic_cycles_per_50ms_event;
-                        }
-                    }
-                    last_logic_cycle_value = logic_main_cycle_counter;
-                    #endif
-
-                    // 2) trigger cyclical battery voltage measurement
-                    if (local_bools & LB_HW_IS_FIRING) {
-                        if (pulse_counter_for_battery_voltage_measurement > 3) {   // every 200ms (4*50ms) when the mod is firing
-                            do_battery_measurement();
-                            pulse_counter_for_battery_voltage_measurement = 0;
-                        }
-                    }
-//                    else {
-//                        if (pulse_counter_for_battery_voltage_measurement == 40) { // every ~12s (256*50ms) when the mod is _not_ firing
-//                            do_battery_measurement();   // we use "40" as compare value to give the battery 2s (40*50ms) to relax after stopping firing
-//                            // we do not reset the (8 bit) counter but just let it overflow (to get the 256*50ms rhythm)
-//                        }
-//                    }
-                    ++pulse_counter_for_battery_voltage_measurement;
+            // process all pending urgent events first, and again before each of the other events, so an urgent event
+            // never waits longer than the processing of a single other event
+            uint8_t switch_off = _process_urgent_events();      // (1 if the device has been switched off)
+            // process all pending UI events
+            while (!switch_off && (n = queue_get_read_elements(&ui_event_queue, &e)) > 0) {
+                uint8_t processed = 0;
+                while (!switch_off && processed < n) {
+                    switch_off = _process_urgent_events() || _process_ui_event(e + processed++);
                 }
+                queue_commit_read_elements(&ui_event_queue, processed);
             }
-            //process HW event
-            e = queue_get_read_element(&hw_event_queue);
-            if (e != 0) {
-                if (e->bytes.a == HW__FIRE_ON) {
-                    local_bools |= LB_HW_IS_FIRING;
-                    pulse_counter_for_battery_voltage_measurement = 0;
-                    ui_fire_is_on();
-                }
-                else if (e->bytes.a == HW__FIRE_OFF) {
-                    local_bools &= ~LB_HW_IS_FIRING;
-                    pulse_counter_for_battery_voltage_measurement = 0;
-                    ui_fire_is_off();
-                }
-                else if (e->bytes.a == HW__BATTERY_MEASURE) {
-                    if (local_bools & LB_HW_IS_FIRING) {
-                        battery_voltage_under_load = e->bytes.b;
-                        // check if the battery voltage has dropped so low that we have to block firing
-                        if (battery_voltage_under_load <= BATTERY_VOLTAGE_STOP_VALUE) {
-                            ui_switch_off_forced();
-                            hardware_fire_off();
-                        }
+            // process all pending HW events (including those that are created while processing)
+            while (!switch_off && (n = queue_get_read_elements(&hw_event_queue, &e)) > 0) {
+                uint8_t processed = 0;
+                while (!switch_off && processed < n) {
+                    switch_off = _process_urgent_events();
+                    if (!switch_off) {
+                        _process_hw_event(e + processed++);
                     }
-                    #ifdef UART_ENABLED
-                    if (local_bools & LB_PRINT_BVMS) {
-                        deviface_putstring("BVM: ");
-                        deviface_put_uint8(e->bytes.b);
-                        deviface_putlineend();
-                    }
-                    #endif
                 }
+                queue_commit_read_elements(&hw_event_queue, processed);
             }
+        }
+        if (logic_device_is_in(DS_SLEEPING)) {
+            // switched off or awakening aborted: go to sleep
+            hardware_power_down();
+            ui_power_down();
+            mcu_power_down_till_pin_change();
+            statemachine_dispatch(&device_state_machine, DEV_EV_WAKE_UP);
+            continue;
+        }
     #ifdef UART_ENABLED
-            //process commands from the devolper interface (deviface) (UART)
-            if (uart_str_complete) {
-                char in_string[UART_MAXSTRLEN + 1];
-                strcpy (in_string, uart_string);
-                uart_str_complete = 0;
-                if (strcmp(in_string, "off") == 0) {
-                    hardware_fire_off();
-                }
-                if (strcmp(in_string, "on") == 0) {
-                    hardware_fire_on();
-                }
-                if (strcmp(in_string, "bvm") == 0) {
-                    do_battery_measurement();
-                }
-                if (strcmp(in_string, "cyc l50") == 0) {
-                    deviface_putstring("Last cycle number per 50ms event: ");
-                    deviface_put_uint16(last_logic_cycles_per_50ms_event);
-                    deviface_putlineend();
-                }
-                if (strcmp(in_string, "cyc m50") == 0) {
-                    deviface_putstring("Minimum cycles number per 50ms event: ");
-                    deviface_put_uint16(min_logic_cycles_per_50ms_event);
-                    deviface_putlineend();
-                }
-                if (strcmp(in_string, "cyc count") == 0) {
-                    deviface_putstring("Main cycle counter: ");
-                    deviface_put_uint16(logic_main_cycle_counter);
-                    deviface_putlineend();
-                }
-                if (strcmp(in_string, "ui leds") == 0) {
-                    ui_print_led_info();
-                }
-                if (strcmp(in_string, "bv") == 0) {
-                    deviface_putstring("Battery voltage under load: ");
-                    deviface_put_uint8(battery_voltage_under_load);
-                    deviface_putstring("\n\r");
-                }
-                if (strcmp(in_string, "p bvm on") == 0) {
-                    local_bools |= LB_PRINT_BVMS;
-                }
-                if (strcmp(in_string, "p bvm off") == 0) {
-                    local_bools &= ~LB_PRINT_BVMS;
-                }
-            }
-    #endif
-            logic_main_cycle_counter++;
+        //process commands from the devolper interface (deviface) (UART)
+        if (uart_str_complete) {
+            // (the ISR doesn't touch the string before uart_str_complete is reset)
+            deviface_execute_command(deviface_command_tables, DEVIFACE_COMMAND_TABLE_COUNT, (const char*) uart_string);
+            uart_str_complete = 0;
         }
+    #endif
+        _sleep_if_idle();   // wait for the next interrupt if there is nothing left to do
     }
     return 0;
 }
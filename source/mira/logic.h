@@ -22,15 +22,39 @@
 #include <avr/io.h>
 #include "queue.h"
 
-#define BATTERY_VOLTAGE_LOW_VALUE 35
-#define BATTERY_VOLTAGE_VERY_LOW_VALUE 32
-#define BATTERY_VOLTAGE_STOP_VALUE 29
+// Battery voltage thresholds (under load) in mV
+#define BATTERY_VOLTAGE_LOW_VALUE 3500
+#define BATTERY_VOLTAGE_VERY_LOW_VALUE 3200
+#define BATTERY_VOLTAGE_STOP_VALUE 2900
 
-extern uint8_t battery_voltage_under_load;
-extern uint8_t global_state;
+// Predicted firing time left (see \ref battery) below which the UI warns, in s
+#define BATTERY_SECONDS_LEFT_LOW 120
+#define BATTERY_SECONDS_LEFT_VERY_LOW 30
 
-#define GS_ON        2  // device is on
-#define GS_AWAKENING 3  // device just left deep sleep because of interrupt but the on-command from the UI is not received yet
+// Battery voltage under load in mV (0 if not measured yet)
+extern uint16_t battery_voltage_under_load;
+
+// Predicted firing time left in s (BATTERY_UNKNOWN as long as there is no prediction)
+extern uint16_t battery_seconds_left;
+
+// Device states (indexes of the device state machine, see \ref statemachine)
+#define DS_ON           0   // device is on (parent of the states below but the sleeping and awakening ones)
+#define DS_IDLE         1   // on, not firing
+#define DS_FIRING       2   // on, the fire button is pressed and the hardware fires
+#define DS_FORCED_OFF   3   // on, the fire button is still pressed but firing was stopped due to a too low battery voltage
+#define DS_LOW_BATTERY  4   // on, not firing, but the last firing was forced off
+#define DS_SLEEPING     5   // device is switched off (power down)
+#define DS_AWAKENING    6   // device just left deep sleep because of interrupt but the on-command from the UI is not received yet
+#define DS_COIL_FAULT   7   // on, the fire button is still pressed but the coil check has cut the MOSFET (short or open coil)
+#define DS_FIRING_SPECULATIVE 8 // firing (child of DS_FIRING), fast fire: since the press started, till it's confirmed as no click
+#define DS_COUNT        9
+
+// Returns 1 if the device is in the given state (or one of its child states)
+uint8_t logic_device_is_in(uint8_t state);
+
+// Returns 1 if the logic needs the UI__50MS_PULSE events (firing, a battery measurement scheduled), the UI may
+// stop its tick otherwise
+uint8_t logic_wants_pulses(void);
 
 
 uint8_t logic_init(void);
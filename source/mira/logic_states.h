@@ -0,0 +1,85 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Tables of the device state machine (see \ref statemachine), included by logic.c, which defines the actions
+ * before. They are kept apart so that the machine can be checked on the host (see test/test_statemachine.c).
+ *
+ * The events are the UI events (UI__*, see ui.h) plus the following ones.
+ */
+
+#ifndef LOGIC_STATES_H
+#define LOGIC_STATES_H
+
+#include "statemachine.h"
+#include "logic.h"
+#include "ui.h"
+
+#define DEV_EV_UNDER_VOLTAGE    16  // battery voltage under load dropped to BATTERY_VOLTAGE_STOP_VALUE
+#define DEV_EV_WAKE_UP          17  // the MCU left the power down mode
+#define DEV_EV_COIL_FAULT       18  // the coil check at fire start has tripped (the MOSFET is off already)
+#define DEV_EV_FIRE_TIMEOUT     19  // the maximum fire duration is over (the MOSFET is off already)
+
+static const State device_states[DS_COUNT] PROGMEM = {
+    [DS_ON]          = { STATE_NONE, 0,                 0 },
+    [DS_IDLE]        = { DS_ON,      0,                 0 },
+    [DS_FIRING]      = { DS_ON,      _enter_firing,     _exit_firing },
+    [DS_FORCED_OFF]  = { DS_ON,      _enter_forced_off, 0 },
+    [DS_LOW_BATTERY] = { DS_ON,      0,                 0 },
+    [DS_SLEEPING]    = { STATE_NONE, _enter_sleeping,   0 },
+    [DS_AWAKENING]   = { STATE_NONE, 0,                 0 },
+    [DS_COIL_FAULT]  = { DS_ON,      _enter_coil_fault, 0 },
+    // (a child of DS_FIRING: the confirmation goes on firing, the transitions of DS_FIRING switch off on a click)
+    [DS_FIRING_SPECULATIVE] = { DS_FIRING, 0,           0 },
+};
+
+// grouped by state, in the order of the states (see device_transition_index)
+static const Transition device_transitions[] PROGMEM = {
+    // state            event                       target          action
+    { DS_ON,            UI__SWITCH_OFF,             DS_SLEEPING,    0 },                    // 0
+    { DS_IDLE,          UI__FIRE_BUTTON_PRESSED,    DS_FIRING,      0 },                    // 1
+    { DS_IDLE,          UI__FIRE_BUTTON_PRESS_STARTED, DS_FIRING_SPECULATIVE, 0 },
+    { DS_FIRING,        UI__FIRE_BUTTON_RELEASED,   DS_IDLE,        0 },                    // 3
+    { DS_FIRING,        DEV_EV_UNDER_VOLTAGE,       DS_FORCED_OFF,  0 },
+    { DS_FIRING,        DEV_EV_COIL_FAULT,          DS_COIL_FAULT,  0 },
+    { DS_FIRING,        DEV_EV_FIRE_TIMEOUT,        DS_IDLE,        _fire_timed_out },
+    { DS_FORCED_OFF,    UI__FIRE_BUTTON_RELEASED,   DS_LOW_BATTERY, 0 },                    // 7
+    { DS_LOW_BATTERY,   UI__FIRE_BUTTON_PRESSED,    DS_FIRING,      0 },                    // 8
+    { DS_LOW_BATTERY,   UI__FIRE_BUTTON_PRESS_STARTED, DS_FIRING_SPECULATIVE, 0 },
+    { DS_SLEEPING,      DEV_EV_WAKE_UP,             DS_AWAKENING,   0 },                    // 10
+    { DS_AWAKENING,     UI__SWITCH_ON,              DS_IDLE,        _power_up },            // 11
+    { DS_AWAKENING,     UI__ABORT_AWAKENING,        DS_SLEEPING,    0 },
+    { DS_COIL_FAULT,    UI__FIRE_BUTTON_RELEASED,   DS_IDLE,        0 },                    // 13
+    { DS_FIRING_SPECULATIVE, UI__FIRE_BUTTON_CONFIRMED, DS_FIRING,  0 },                    // 14
+};
+
+// position of the first transition of each state in device_transitions (the last entry is the number of transitions)
+static const uint8_t device_transition_index[DS_COUNT + 1] PROGMEM = {
+    [DS_ON]          = 0,
+    [DS_IDLE]        = 1,
+    [DS_FIRING]      = 3,
+    [DS_FORCED_OFF]  = 7,
+    [DS_LOW_BATTERY] = 8,
+    [DS_SLEEPING]    = 10,
+    [DS_AWAKENING]   = 11,
+    [DS_COIL_FAULT]  = 13,
+    [DS_FIRING_SPECULATIVE] = 14,
+    [DS_COUNT]       = sizeof(device_transitions) / sizeof(Transition),
+};
+
+#endif // LOGIC_STATES_H
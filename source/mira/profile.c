@@ -0,0 +1,121 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <avr/io.h>
+#include <util/atomic.h>
+#include "profile.h"
+#include "deviface.h"
+#include MCUHEADER
+
+#ifdef PROFILING
+
+static ProfileSection profile_sections[PROF_SECTION_COUNT];
+
+static const char profile_section_names[PROF_SECTION_COUNT][5] PROGMEM = {
+    "ui",
+    "hw",
+    "isr",
+    "led",
+    "bvm",
+    "dev",
+    "fire",
+    "coil",
+};
+
+// Begin of the section started by PROFILE_MARK() (set in the UI timer ISR, so it's read atomically)
+static volatile uint16_t profile_mark_timestamp;
+static volatile uint8_t profile_mark_is_set = 0;
+
+void profile_record(uint8_t section, uint16_t begin) {
+    uint16_t duration = mcu_read_free_running_timer() - begin;
+    ProfileSection* s = &profile_sections[section];
+    // (a section of the main loop may be interrupted by an ISR recording its own section, but never the same one)
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        if (s->calls == 0 || duration < s->min) {
+            s->min = duration;
+        }
+        if (duration > s->max) {
+            s->max = duration;
+        }
+        if (s->calls != 0xFFFF) {
+            s->calls++;
+            s->total += duration;
+        }
+    }
+}
+
+void profile_mark(void) {
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        profile_mark_timestamp = mcu_read_free_running_timer();
+        profile_mark_is_set = 1;
+    }
+}
+
+void profile_record_mark(uint8_t section) {
+    uint16_t begin;
+    uint8_t is_set;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        begin = profile_mark_timestamp;
+        is_set = profile_mark_is_set;
+        profile_mark_is_set = 0;
+    }
+    if (is_set) {
+        profile_record(section, begin);
+    }
+}
+
+void profile_unmark(void) {
+    profile_mark_is_set = 0;
+}
+
+static void _command_print_and_reset_profile(void) {
+    uint8_t n;
+    deviface_putline("cycles: calls min max avg total");
+    for (n = 0; n < PROF_SECTION_COUNT; n++) {
+        ProfileSection s;
+        // take a consistent copy, the ISR sections may be updated meanwhile
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            s = profile_sections[n];
+            profile_sections[n].calls = 0;
+            profile_sections[n].max = 0;
+            profile_sections[n].total = 0;
+        }
+        deviface_putstring_P(profile_section_names[n]);
+        deviface_putstring(": ");
+        deviface_put_uint16(s.calls);
+        if (s.calls > 0) {
+            deviface_putstring(" ");
+            deviface_put_uint32((uint32_t) s.min * MCU_FREE_RUNNING_TIMER_PRESCALER);
+            deviface_putstring(" ");
+            deviface_put_uint32((uint32_t) s.max * MCU_FREE_RUNNING_TIMER_PRESCALER);
+            deviface_putstring(" ");
+            deviface_put_uint32(s.total / s.calls * MCU_FREE_RUNNING_TIMER_PRESCALER);
+            deviface_putstring(" ");
+            deviface_put_uint32(s.total * MCU_FREE_RUNNING_TIMER_PRESCALER);
+        }
+        deviface_putlineend();
+    }
+}
+
+static const DevifaceCommand profile_commands[] PROGMEM = {
+    {"prof",        _command_print_and_reset_profile,   "print and reset run times"},
+};
+const DevifaceCommandTable profile_deviface_commands PROGMEM = DEVIFACE_COMMAND_TABLE(profile_commands);
+
+#endif // PROFILING
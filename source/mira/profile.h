@@ -0,0 +1,109 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+/** \defgroup profile Profile
+*   \brief Run time measurement of code sections (for development purposes only).
+*
+*   A profiled section is enclosed by PROFILE_BEGIN() and PROFILE_END(). Both read the free running timer,
+*   the difference is added to the statistics of the section: number of calls, shortest, longest and total
+*   run time. The deviface command "prof" prints the statistics in CPU cycles and resets them.
+*
+*   The run time of a section in the main loop includes the ISRs that interrupted it, the run time of the
+*   UI input step includes led_step_all() and the one of hardware_step() includes sm_bvm() (sections may be nested).
+*   The resolution is one timer tick (#MCU_FREE_RUNNING_TIMER_PRESCALER cycles), sections must not
+*   take longer than one timer period.
+*
+*   A section that ends in another function (or module) is started by PROFILE_MARK() and ended by
+*   PROFILE_END_MARK(). Only one such section can be open at a time; PROFILE_UNMARK() drops it.
+*   It's used to measure the latency from the debounced press of the fire button till the MOSFET is switched on
+*   and from there till the coil check is done.
+*
+*   Profiling is available with the UART and the free running timer only (#PROFILING is defined then),
+*   otherwise the macros are empty.
+*/
+
+#include <avr/io.h>
+#include MCUHEADER
+
+#if defined(UART_ENABLED) && defined(MCU_FREE_RUNNING_TIMER)
+    #define PROFILING
+#endif
+
+// The profiled sections
+#define PROF_UI_INPUT_STEP  0   // ui_input_step()
+#define PROF_HARDWARE_STEP  1   // hardware_step()
+#define PROF_UI_TIMER_ISR   2   // the UI timer ISR, each overflow (LED dithering, debouncing, tick counting)
+#define PROF_LED_STEP       3   // led_step_all() (in ui_input_step(), once per UI tick)
+#define PROF_SM_BVM         4   // sm_bvm(), the battery voltage measurement
+#define PROF_DEVIFACE       5   // the deviface command handlers
+#define PROF_FIRE_LATENCY   6   // debounced press of the fire button (UI timer ISR) till the MOSFET is on
+#define PROF_COIL_CHECK     7   // MOSFET on till the coil check has decided (and tripped) in the ADC ISR
+#define PROF_SECTION_COUNT  8
+
+#ifdef PROFILING
+
+#include "deviface.h"
+
+typedef struct {
+    uint16_t calls;         // number of finished runs (stops at 0xFFFF)
+    uint16_t min;           // shortest run in timer ticks
+    uint16_t max;           // longest run in timer ticks
+    uint32_t total;         // sum of all runs in timer ticks
+} ProfileSection;
+
+// Starts the measurement of a section (declares a local variable, so use it once per section and block)
+#define PROFILE_BEGIN(section) uint16_t _profile_begin_##section = mcu_read_free_running_timer()
+// Ends the measurement of a section and records it
+#define PROFILE_END(section) profile_record(section, _profile_begin_##section)
+// Starts the measurement of a section that is ended by PROFILE_END_MARK() somewhere else
+#define PROFILE_MARK(section) profile_mark()
+// Ends the measurement of the section started by PROFILE_MARK() and records it (if it was started)
+#define PROFILE_END_MARK(section) profile_record_mark(section)
+// Drops the section started by PROFILE_MARK() without recording it
+#define PROFILE_UNMARK(section) profile_unmark()
+
+/**
+ * Adds a run of the section that has begun at the given free running timer value.
+ * Can be called from the main loop and from ISRs.
+ */
+void profile_record(uint8_t section, uint16_t begin);
+
+void profile_mark(void);
+
+void profile_record_mark(uint8_t section);
+
+void profile_unmark(void);
+
+// The deviface command "prof" that prints the statistics of all sections in CPU cycles and resets them
+extern const DevifaceCommandTable profile_deviface_commands;
+
+#else
+
+#define PROFILE_BEGIN(section)
+#define PROFILE_END(section)
+#define PROFILE_MARK(section)
+#define PROFILE_END_MARK(section)
+#define PROFILE_UNMARK(section)
+
+#endif // PROFILING
+
+#endif // PROFILE_H
@@ -18,33 +18,150 @@
 
 #include "queue.h"
 
+// Prevents the compiler from moving memory accesses across this point (the element must be
+// written completely before the write index is published and read completely before the
+// read index gives it back).
+#define QUEUE_MEMORY_BARRIER __asm__ __volatile__ ("" ::: "memory")
+
+#ifdef QUEUE_LATENCY_STATISTICS
+/**
+ * Adds the wait time of the element (from its commit till now) to the statistics of the queue.
+ */
+static void _queue_record_latency(Queue* queue, QueueElement* e, uint16_t now) {
+    uint16_t latency = now - e->_timestamp;
+    uint16_t rest = latency;
+    uint8_t bucket = 0;
+    while (rest >= 4 && bucket < QUEUE_LATENCY_BUCKETS - 1) {
+        rest >>= 2;
+        bucket++;
+    }
+    if (queue->latency_histogram[bucket] < 0xFFFF) {
+        queue->latency_histogram[bucket]++;
+    }
+    if (latency > queue->max_latency) {
+        queue->max_latency = latency;
+    }
+}
+#endif
+
 QueueElement* queue_get_write_element(Queue* queue) {
-    QueueElement* result = (queue->queueElementArray + queue->write_index++);
-    if (queue->write_index == queue->number_of_elements) {
-        queue->write_index = 0;
+    uint8_t write_index = queue->write_index;
+    if ((uint8_t)(write_index - queue->read_index) > queue->mask) {
+        // full: drop the element instead of overwriting an unread one
+        if (queue->overflow_count < 255) {
+            queue->overflow_count++;
+        }
+        return 0;
+    }
+    return queue->queueElementArray + (write_index & queue->mask);
+}
+
+void queue_commit_write(Queue* queue) {
+    #ifdef QUEUE_LATENCY_STATISTICS
+    queue->queueElementArray[queue->write_index & queue->mask]._timestamp = mcu_read_free_running_timer();
+    #endif
+    QUEUE_MEMORY_BARRIER;
+    uint8_t write_index = queue->write_index + 1;
+    queue->write_index = write_index;
+    uint8_t fill_level = write_index - queue->read_index;
+    if (fill_level > queue->high_water_mark) {
+        queue->high_water_mark = fill_level;
     }
-    return result;
+}
+
+uint8_t queue_put(Queue* queue, uint8_t a, uint8_t b) {
+    QueueElement* e = queue_get_write_element(queue);
+    if (e == 0) {
+        return QUEUE_DROPPED;
+    }
+    e->bytes.a = a;
+    e->bytes.b = b;
+    queue_commit_write(queue);
+    return ((uint8_t)(queue->write_index - queue->read_index) > queue->mask) ? QUEUE_FULL : QUEUE_OK;
+}
+
+uint8_t queue_put_value(Queue* queue, uint8_t code, uint16_t value) {
+    QueueElement* e = queue_get_write_element(queue);
+    if (e == 0) {
+        return QUEUE_DROPPED;
+    }
+    e->event.code = code;
+    e->event.value = value;
+    queue_commit_write(queue);
+    return ((uint8_t)(queue->write_index - queue->read_index) > queue->mask) ? QUEUE_FULL : QUEUE_OK;
 }
 
 QueueElement* queue_get_read_element(Queue* queue) {
-    if (queue->read_index == queue->write_index) {
+    uint8_t read_index = queue->read_index;
+    if (read_index == queue->write_index) {
         return 0;
     }
-    QueueElement* result = (queue->queueElementArray + queue->read_index++);
-    if (queue->read_index == queue->number_of_elements) {
-        queue->read_index = 0;
+    return queue->queueElementArray + (read_index & queue->mask);
+}
+
+void queue_commit_read(Queue* queue) {
+    #ifdef QUEUE_LATENCY_STATISTICS
+    _queue_record_latency(queue, queue->queueElementArray + (queue->read_index & queue->mask), mcu_read_free_running_timer());
+    #endif
+    QUEUE_MEMORY_BARRIER;
+    queue->read_index++;
+}
+
+uint8_t queue_get_read_elements(Queue* queue, QueueElement** first) {
+    uint8_t read_index = queue->read_index;
+    uint8_t number = queue->write_index - read_index;           // all unread elements...
+    uint8_t array_ix = read_index & queue->mask;
+    uint8_t till_array_end = queue->mask + 1 - array_ix;
+    if (number > till_array_end) {
+        number = till_array_end;                                // ...but not beyond the end of the array
+    }
+    *first = queue->queueElementArray + array_ix;
+    return number;
+}
+
+void queue_commit_read_elements(Queue* queue, uint8_t number) {
+    #ifdef QUEUE_LATENCY_STATISTICS
+    uint16_t now = mcu_read_free_running_timer();
+    uint8_t n;
+    for (n = 0; n < number; n++) {
+        _queue_record_latency(queue, queue->queueElementArray + ((uint8_t)(queue->read_index + n) & queue->mask), now);
     }
-    return result;
+    #endif
+    QUEUE_MEMORY_BARRIER;
+    queue->read_index += number;
+}
+
+uint8_t queue_get_unread_count(Queue* queue) {
+    return queue->write_index - queue->read_index;
 }
 
 void queue_clear(Queue *queue) {
-    queue->read_index = 0;
-    queue->write_index = 0;
+    // only the consumer's index is touched, so a producer may keep on writing meanwhile
+    queue->read_index = queue->write_index;
 }
 
+void queue_reset_statistics(Queue *queue) {
+    queue->overflow_count = 0;
+    queue->high_water_mark = 0;
+}
+
+#ifdef QUEUE_LATENCY_STATISTICS
+void queue_reset_latency_statistics(Queue *queue) {
+    uint8_t n;
+    for (n = 0; n < QUEUE_LATENCY_BUCKETS; n++) {
+        queue->latency_histogram[n] = 0;
+    }
+    queue->max_latency = 0;
+}
+#endif
+
 void queue_initialize(Queue *queue, uint8_t number_of_elements, QueueElement *queue_element_array) {
-    queue_clear(queue);
-    queue->number_of_elements = number_of_elements;
+    queue->read_index = 0;
+    queue->write_index = 0;
+    queue->mask = number_of_elements - 1;
     queue->queueElementArray = queue_element_array;
+    queue_reset_statistics(queue);
+    #ifdef QUEUE_LATENCY_STATISTICS
+    queue_reset_latency_statistics(queue);
+    #endif
 }
-
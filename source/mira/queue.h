@@ -19,31 +19,163 @@
 #ifndef QUEUE_H
 #define QUEUE_H
 
+/** \defgroup queue Queue
+*   \brief Single producer / single consumer ring buffer for small event elements.
+*
+*   A #Queue connects exactly one producer with exactly one consumer, where one side may be an ISR
+*   and the other side the main loop. No interrupts need to be disabled for that: the producer only
+*   writes the write index, the consumer only writes the read index, and both indexes are single bytes
+*   (so reading and writing them is atomic on the AVR).
+*
+*   The number of elements must be a power of two (1, 2, 4, ..., 128). The indexes are free running
+*   counters which are masked when the element array is accessed, so all elements of the array can be used.
+*
+*   Writing is a two step process: the producer gets the next free element by queue_get_write_element(),
+*   fills it and publishes it by queue_commit_write(). Reading is the same: queue_get_read_element()
+*   returns the oldest element, the consumer processes it and gives it back by queue_commit_read().
+*   For the common case of a two byte event, queue_put() does the write steps at once, for an event with a
+*   16 bit value (e.g. a voltage in mV) queue_put_value().
+*
+*   A consumer that wants to process everything that is pending at once (instead of one element per
+*   main loop cycle) uses queue_get_read_elements() which returns all unread elements that are stored
+*   contiguously in the array, and gives them back by queue_commit_read_elements(). Since the unread
+*   elements may wrap around the array end, the consumer calls it until it returns 0.
+*
+*   If the queue is full, the new element is dropped (an unread element is never overwritten) and the
+*   overflow counter of the queue is incremented. Together with the high water mark (the highest number
+*   of unread elements seen so far) it can be used to size the queues.
+*
+*   If #QUEUE_LATENCY_STATISTICS is defined (with the UART), each element is stamped with the free running
+*   timer when it's committed by the producer. When the consumer gives it back, its wait time is added to
+*   a histogram with #QUEUE_LATENCY_BUCKETS logarithmic classes, and the longest wait time is kept.
+*/
+
 #include <avr/io.h>
+#include MCUHEADER
+
+#if defined(UART_ENABLED) && defined(MCU_FREE_RUNNING_TIMER)
+    // Each element gets a timestamp when it's written and the wait time till it's read is recorded per queue.
+    #define QUEUE_LATENCY_STATISTICS
+#endif
+
+// Number of wait time classes of the latency histogram; class n counts the wait times
+// of [4^n, 4^(n+1)) timer ticks, the last one all longer wait times.
+#define QUEUE_LATENCY_BUCKETS 8
 
-typedef union {
-  struct {
-      uint8_t a;
-      uint8_t b;
-  } bytes;
-  unsigned char character;
-  uint16_t word;
+// Results of queue_put()
+#define QUEUE_OK        0   // element enqueued, there is still room for more elements
+#define QUEUE_FULL      1   // element enqueued, but the queue is full now
+#define QUEUE_DROPPED   2   // queue was already full, the element was dropped
+
+typedef struct {
+    union {
+      struct {
+          uint8_t a;
+          uint8_t b;
+      } bytes;
+      struct {
+          uint8_t code;
+          uint16_t value;
+      } event;                          // an event code with a 16 bit value
+      unsigned char character;
+      uint16_t word;
+    };
+    #ifdef QUEUE_LATENCY_STATISTICS
+    uint16_t _timestamp;                // free running timer value when the element was committed
+    #endif
 } QueueElement;
 
 
 typedef struct {
     QueueElement *queueElementArray;
-    uint8_t number_of_elements;
-    uint8_t read_index;
-    uint8_t write_index;
+    uint8_t mask;                       // number of elements - 1
+    volatile uint8_t read_index;        // free running, only written by the consumer
+    volatile uint8_t write_index;       // free running, only written by the producer
+    volatile uint8_t overflow_count;    // number of dropped elements (saturates at 255), only written by the producer
+    volatile uint8_t high_water_mark;   // maximum number of unread elements so far, only written by the producer
+    #ifdef QUEUE_LATENCY_STATISTICS
+    uint16_t latency_histogram[QUEUE_LATENCY_BUCKETS];  // number of elements per wait time class (saturating), only written by the consumer
+    uint16_t max_latency;               // longest wait time in timer ticks, only written by the consumer
+    #endif
 } Queue;
 
+/**
+ * \brief Returns the next free element or 0 if the queue is full (producer side).
+ *
+ * The element is not visible for the consumer before queue_commit_write() is called.
+ * If the queue is full, the overflow counter is incremented.
+ */
 QueueElement* queue_get_write_element(Queue *queue);
 
+/**
+ * \brief Publishes the element returned by the last queue_get_write_element() call (producer side).
+ */
+void queue_commit_write(Queue *queue);
+
+/**
+ * \brief Writes a two byte element (a and b) to the queue (producer side).
+ *
+ * \return #QUEUE_OK, #QUEUE_FULL or #QUEUE_DROPPED
+ */
+uint8_t queue_put(Queue *queue, uint8_t a, uint8_t b);
+
+/**
+ * \brief Writes an event code with a 16 bit value to the queue (producer side).
+ *
+ * \return #QUEUE_OK, #QUEUE_FULL or #QUEUE_DROPPED
+ */
+uint8_t queue_put_value(Queue *queue, uint8_t code, uint16_t value);
+
+/**
+ * \brief Returns the oldest unread element or 0 if the queue is empty (consumer side).
+ *
+ * The element stays in the queue until queue_commit_read() is called.
+ */
 QueueElement* queue_get_read_element(Queue *queue);
 
+/**
+ * \brief Removes the element returned by the last queue_get_read_element() call (consumer side).
+ */
+void queue_commit_read(Queue *queue);
+
+/**
+ * \brief Returns the number of unread elements that are stored contiguously, starting with the oldest one (consumer side).
+ *
+ * \param first is set to the oldest unread element (if the result is not 0)
+ * \return the number of elements that can be read from first on, 0 if the queue is empty
+ */
+uint8_t queue_get_read_elements(Queue *queue, QueueElement **first);
+
+/**
+ * \brief Removes number elements, e.g. after processing the elements returned by queue_get_read_elements() (consumer side).
+ */
+void queue_commit_read_elements(Queue *queue, uint8_t number);
+
+/**
+ * \brief Returns the number of unread elements (may be used by both sides, but the result can be outdated immediately).
+ */
+uint8_t queue_get_unread_count(Queue *queue);
+
+/**
+ * \brief Initializes the queue; number_of_elements must be a power of two.
+ */
 void queue_initialize(Queue *queue, uint8_t number_of_elements, QueueElement *queue_element_array);
 
+/**
+ * \brief Drops all unread elements (consumer side).
+ */
 void queue_clear(Queue *queue);
 
+/**
+ * \brief Sets the overflow counter and the high water mark back to 0.
+ */
+void queue_reset_statistics(Queue *queue);
+
+#ifdef QUEUE_LATENCY_STATISTICS
+/**
+ * \brief Clears the latency histogram and the longest wait time.
+ */
+void queue_reset_latency_statistics(Queue *queue);
+#endif
+
 #endif // QUEUE_H
@@ -0,0 +1,99 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "statemachine.h"
+
+static uint8_t _parent(StateMachine* sm, uint8_t state) {
+    return pgm_read_byte(&(sm->states[state].parent));
+}
+
+static uint8_t _is_ancestor_or_self(StateMachine* sm, uint8_t ancestor, uint8_t state) {
+    while (state != STATE_NONE) {
+        if (state == ancestor) {
+            return 1;
+        }
+        state = _parent(sm, state);
+    }
+    return 0;
+}
+
+static void _call(const StateAction* action_in_progmem) {
+    StateAction action = (StateAction) pgm_read_ptr(action_in_progmem);
+    if (action) {
+        action();
+    }
+}
+
+/**
+ * Calls the entry actions from below ancestor down to state (top down).
+ */
+static void _enter(StateMachine* sm, uint8_t ancestor, uint8_t state) {
+    if (state == ancestor || state == STATE_NONE) {
+        return;
+    }
+    _enter(sm, ancestor, _parent(sm, state));
+    _call(&(sm->states[state].entry));
+}
+
+void statemachine_init(StateMachine* sm, const State* states, const Transition* transitions, const uint8_t* index, uint8_t initial) {
+    sm->states = states;
+    sm->transitions = transitions;
+    sm->index = index;
+    sm->current = initial;
+    _enter(sm, STATE_NONE, initial);
+}
+
+uint8_t statemachine_dispatch(StateMachine* sm, uint8_t event) {
+    // look up the transition: the current state first, then its ancestors
+    const Transition* transition = 0;
+    uint8_t state = sm->current;
+    while (transition == 0 && state != STATE_NONE) {
+        const Transition* t = sm->transitions + pgm_read_byte(&(sm->index[state]));
+        const Transition* end = sm->transitions + pgm_read_byte(&(sm->index[state + 1]));
+        for (; t < end; t++) {
+            if (pgm_read_byte(&(t->event)) == event) {
+                transition = t;
+                break;
+            }
+        }
+        state = _parent(sm, state);
+    }
+    if (transition == 0) {
+        return 0;
+    }
+
+    uint8_t target = pgm_read_byte(&(transition->target));
+    if (target == STATE_NONE) {
+        _call(&(transition->action));   // internal transition
+        return 1;
+    }
+    // exit up to the lowest common ancestor of the current and the target state
+    state = sm->current;
+    while (state != STATE_NONE && !_is_ancestor_or_self(sm, state, target)) {
+        _call(&(sm->states[state].exit));
+        state = _parent(sm, state);
+    }
+    _call(&(transition->action));
+    sm->current = target;
+    _enter(sm, state, target);
+    return 1;
+}
+
+uint8_t statemachine_is_in(StateMachine* sm, uint8_t state) {
+    return _is_ancestor_or_self(sm, state, sm->current);
+}
@@ -0,0 +1,88 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/** \defgroup statemachine State Machine
+*   \brief Table driven hierarchical state machine.
+*
+*   The states and transitions of a machine are constant tables in flash (PROGMEM). A state is identified
+*   by its index in the state table and may have a parent state (#STATE_NONE for top level states).
+*   A transition defined for a parent state applies to all of its children, unless a child defines a
+*   transition for the same event itself.
+*
+*   The transitions are grouped by state (in the order of the states). A PROGMEM index table holds the
+*   position of the first transition of each state, plus the number of transitions as the last entry, so
+*   statemachine_dispatch() only looks at the transitions of the current state (and then of its ancestors)
+*   to find the one for the event. For a transition to another state, the exit actions are called from the current state up to
+*   (but not including) the lowest common ancestor of the current and the target state, then the transition
+*   action, then the entry actions from below the common ancestor down to the target. A transition with
+*   target #STATE_NONE is internal: only its action is called.
+*
+*   The module has no dependencies but the PROGMEM access, so a machine can be checked on the host as well.
+*
+*   The same object oriented style as in \ref button is used: all functions take the #StateMachine as first argument.
+*/
+
+#ifndef STATEMACHINE_H
+#define STATEMACHINE_H
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+// State index meaning "no state" (parent of top level states, target of internal transitions)
+#define STATE_NONE 255
+
+typedef void (*StateAction)(void);
+
+typedef struct {
+    uint8_t parent;         // index of the parent state or STATE_NONE
+    StateAction entry;      // called when the state is entered, may be 0
+    StateAction exit;       // called when the state is left, may be 0
+} State;
+
+typedef struct {
+    uint8_t state;          // the state (or parent state) the transition is defined for
+    uint8_t event;          // the triggering event
+    uint8_t target;         // the target state or STATE_NONE for an internal transition
+    StateAction action;     // called between the exit and the entry actions, may be 0
+} Transition;
+
+typedef struct {
+    const State* states;            // PROGMEM table of states
+    const Transition* transitions;  // PROGMEM table of transitions, grouped by state
+    const uint8_t* index;           // PROGMEM table of the first transition per state (one entry more than states)
+    uint8_t current;                // index of the current state
+} StateMachine;
+
+/**
+ * \brief Initializes the machine and enters the initial state (entry actions of all its ancestors first).
+ */
+void statemachine_init(StateMachine* sm, const State* states, const Transition* transitions, const uint8_t* index, uint8_t initial);
+
+/**
+ * \brief Processes an event.
+ *
+ * \return 1 if a transition was found for the event, 0 if it was ignored
+ */
+uint8_t statemachine_dispatch(StateMachine* sm, uint8_t event);
+
+/**
+ * \brief Returns 1 if state is the current state or one of its ancestors.
+ */
+uint8_t statemachine_is_in(StateMachine* sm, uint8_t state);
+
+#endif // STATEMACHINE_H
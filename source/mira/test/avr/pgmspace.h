@@ -0,0 +1,31 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Host shim of <avr/pgmspace.h>: there's only one address space, so PROGMEM data is read directly.
+
+#ifndef PGMSPACE_H_HOST_SHIM
+#define PGMSPACE_H_HOST_SHIM
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(address) (*(const uint8_t*) (address))
+#define pgm_read_word(address) (*(const uint16_t*) (address))
+#define pgm_read_ptr(address) (*(void* const*) (address))
+
+#endif // PGMSPACE_H_HOST_SHIM
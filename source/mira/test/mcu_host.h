@@ -0,0 +1,31 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// MCU header for the host tests (MCUHEADER): no MCU features, so the modules under test don't use any.
+
+#ifndef MCU_HOST_H
+#define MCU_HOST_H
+
+#include <stdint.h>
+
+#ifdef MCU_FREE_RUNNING_TIMER
+// the test provides the timer (e.g. for the queue latency statistics)
+uint16_t mcu_read_free_running_timer(void);
+#endif
+
+#endif // MCU_HOST_H
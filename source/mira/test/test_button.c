@@ -0,0 +1,203 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Host test of the button engine as the UI drives it (see ui.c): the debounced states at a 10 ms tick, a button
+ * step every fifth tick. It checks the event sequences of presses and click gestures with and without the press
+ * start reports (fast fire), and measures for each phase of the step cadence when the fire is on as the UI maps
+ * the events (on at press started or pressed, off at press canceled or released): the ticks from the debounced
+ * press edge till the fire is on for a held press (the sustained fire) and how long a click fires.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "button.h"
+
+#define TICKS_PER_STEP 5    // 50 ms steps of 10 ms ticks
+#define FIRE_BUTTON 0
+
+static Buttons buttons;
+static unsigned tick;       // ticks since the start of a run
+static unsigned phase;      // tick of the first step
+static unsigned failures = 0;
+
+#define CHECK(condition, ...) do { \
+        if (!(condition)) { \
+            printf("%s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+// events of a run: code and value, and the ticks the fire is switched on and off first
+static char events[64];
+static unsigned fire_on_tick;
+static unsigned fire_off_tick;
+
+static void _collect_events(void) {
+    QueueElement* e;
+    while ((e = queue_get_read_element(&buttons.button_event_queue)) != 0) {
+        uint8_t code = BUTTON_EVENT_CODE(e->bytes.a);
+        char text[6] = "?";
+        switch (code) {
+            case BUTTON_EVENT_PRESS_STARTED:  text[0] = 'S'; break;
+            case BUTTON_EVENT_PRESS_CANCELED: text[0] = 'X'; break;
+            case BUTTON_EVENT_PRESSED:        text[0] = 'P'; break;
+            case BUTTON_EVENT_RELEASED:       text[0] = 'R'; break;
+            case BUTTON_EVENT_CLICK:          sprintf(text, "C%u", e->bytes.b); break;
+        }
+        if ((code == BUTTON_EVENT_PRESS_STARTED || code == BUTTON_EVENT_PRESSED) && fire_on_tick == ~0u) {
+            fire_on_tick = tick;
+        }
+        if ((code == BUTTON_EVENT_PRESS_CANCELED || code == BUTTON_EVENT_RELEASED) && fire_off_tick == ~0u) {
+            fire_off_tick = tick;
+        }
+        if (events[0]) {
+            strcat(events, " ");
+        }
+        strcat(events, text);
+        queue_commit_read(&buttons.button_event_queue);
+    }
+}
+
+static void _start(uint8_t report_press_start, unsigned step_phase) {
+    buttons_init(&buttons);
+    buttons_report_press_start(&buttons, FIRE_BUTTON, report_press_start);
+    tick = 0;
+    phase = step_phase;
+    events[0] = 0;
+    fire_on_tick = ~0u;
+    fire_off_tick = ~0u;
+}
+
+/**
+ * Runs the ticks till the given tick, then gives the button state (the new state comes in before the step of its tick).
+ */
+static void _set_at(unsigned at_tick, uint8_t pressed) {
+    for (; tick < at_tick; tick++) {
+        if (tick % TICKS_PER_STEP == phase) {
+            buttons_step(&buttons);
+            _collect_events();
+        }
+    }
+    buttons_set_states(&buttons, pressed ? (1<<FIRE_BUTTON) : 0);
+    _collect_events();
+}
+
+static void _run_till(unsigned at_tick) {
+    _set_at(at_tick, buttons._states & (1<<FIRE_BUTTON));
+}
+
+/**
+ * Presses at tick 0 for the given durations (ticks pressed, released, pressed, ...) and returns the events.
+ */
+static const char* _gesture(uint8_t report_press_start, unsigned step_phase, const unsigned* durations, uint8_t count) {
+    unsigned at = 0;
+    uint8_t i;
+    _start(report_press_start, step_phase);
+    for (i = 0; i < count; i++) {
+        _set_at(at, !(i & 1));
+        at += durations[i];
+    }
+    _set_at(at, 0);
+    _run_till(at + 10 * TICKS_PER_STEP);
+    return events;
+}
+
+static void test_gestures(void) {
+    static const unsigned press[] = { 60 };
+    static const unsigned click[] = { 8 };
+    static const unsigned double_click[] = { 8, 8, 8 };
+    static const unsigned click_and_press[] = { 8, 8, 60 };
+    unsigned p;
+    for (p = 0; p < TICKS_PER_STEP; p++) {
+        const char* e;
+        e = _gesture(0, p, press, 1);
+        CHECK(strcmp(e, "P R") == 0, "press, phase %u: %s", p, e);
+        e = _gesture(1, p, press, 1);
+        CHECK(strcmp(e, "S P R") == 0, "fast press, phase %u: %s", p, e);
+        e = _gesture(0, p, click, 1);
+        CHECK(strcmp(e, "C1") == 0, "click, phase %u: %s", p, e);
+        e = _gesture(1, p, click, 1);
+        CHECK(strcmp(e, "S X C1") == 0, "fast click, phase %u: %s", p, e);
+        e = _gesture(1, p, double_click, 3);
+        CHECK(strcmp(e, "S X C2") == 0, "fast double click, phase %u: %s", p, e);
+        e = _gesture(1, p, click_and_press, 3);
+        CHECK(strcmp(e, "S X P R") == 0, "fast click and press, phase %u: %s", p, e);
+    }
+}
+
+/**
+ * Ticks from the debounced press edge till the fire is on for a held press, and the fire duration of a click.
+ */
+static void test_fire_latency(void) {
+    static const unsigned press[] = { 60 };
+    static const unsigned click[] = { 8 };
+    uint8_t fast;
+    for (fast = 0; fast <= 1; fast++) {
+        unsigned p, min = ~0u, max = 0;
+        for (p = 0; p < TICKS_PER_STEP; p++) {
+            _gesture(fast, p, press, 1);
+            CHECK(fire_off_tick == press[0], "phase %u: the held press is off at tick %u", p, fire_off_tick);
+            if (fire_on_tick < min) min = fire_on_tick;
+            if (fire_on_tick > max) max = fire_on_tick;
+            _gesture(fast, p, click, 1);
+            if (fast) {
+                CHECK(fire_on_tick == 0 && fire_off_tick == click[0], "phase %u: the click fires from tick %u till %u",
+                    p, fire_on_tick, fire_off_tick);
+            } else {
+                CHECK(fire_on_tick == ~0u, "phase %u: the click fires", p);
+            }
+        }
+        printf("test_button: %s fire: press edge to sustained fire %u..%u ticks (10 ms), a click fires %u ticks\n",
+            fast ? "fast" : "normal", min, max, fast ? click[0] : 0);
+        if (fast) {
+            CHECK(max == 0, "the fire is not on in the tick of the edge");
+        } else {
+            CHECK(min > 0, "the fire is on in the tick of the edge");
+        }
+    }
+}
+
+/**
+ * After lost updates (the UI's low level queue was full), feeding the current states again releases the button.
+ */
+static void test_lost_updates(void) {
+    _start(1, 0);
+    _set_at(0, 1);
+    _run_till(30);
+    // released, pressed and released again at ticks 30..32, but only the states after the stall are fed
+    _set_at(40, 0);
+    _set_at(40, 0);     // (the same states again change nothing)
+    _run_till(100);
+    CHECK(strcmp(events, "S P R") == 0, "lost updates: %s", events);
+    CHECK(fire_off_tick == 40, "lost updates: off at tick %u", fire_off_tick);
+}
+
+int main(void) {
+    test_gestures();
+    test_lost_updates();
+    test_fire_latency();
+    if (failures) {
+        printf("test_button: %u failures\n", failures);
+        return 1;
+    }
+    printf("test_button: ok\n");
+    return 0;
+}
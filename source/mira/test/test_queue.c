@@ -0,0 +1,208 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Host test of the queue's drain API (queue_get_read_elements() over the array end) and a model of the event hops
+ * of the main loop (see logic_loop() and ui_input_step()) that measures the enqueue to handling times with the
+ * latency statistics (as "ql" prints them on the device). The free running timer counts main loop passes here.
+ * Each pass either takes one element per queue, as the loops did before the drain, or drains every queue, with the
+ * queue sizes of today in both cases. The switch debouncing, the button timing and the run time of a pass are not
+ * modeled (the "ql" statistics on the device give the times in timer ticks).
+ */
+
+#include <stdio.h>
+#include "queue.h"
+
+static unsigned failures = 0;
+
+#define CHECK(condition, ...) do { \
+        if (!(condition)) { \
+            printf("%s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+static uint16_t passes = 0;
+
+uint16_t mcu_read_free_running_timer(void) {
+    return passes;
+}
+
+/**
+ * The drain API hands out the unread elements up to the array end, then the rest.
+ */
+static void test_read_elements(void) {
+    Queue queue;
+    QueueElement elements[4];
+    QueueElement* e;
+    uint8_t i;
+    queue_initialize(&queue, 4, elements);
+    for (i = 0; i < 3; i++) {
+        queue_put(&queue, i, 0);
+    }
+    queue_commit_read_elements(&queue, queue_get_read_elements(&queue, &e));
+    CHECK(queue_put(&queue, 3, 0) == QUEUE_OK, "put 3");
+    CHECK(queue_put(&queue, 4, 0) == QUEUE_OK, "put 4");
+    CHECK(queue_put(&queue, 5, 0) == QUEUE_OK, "put 5");
+    CHECK(queue_put(&queue, 6, 0) == QUEUE_FULL, "put 6");
+    CHECK(queue_put(&queue, 7, 0) == QUEUE_DROPPED, "put 7");
+    CHECK(queue.overflow_count == 1, "overflows: %u", queue.overflow_count);
+    CHECK(queue_get_read_elements(&queue, &e) == 1 && e->bytes.a == 3, "first run");
+    queue_commit_read_elements(&queue, 1);
+    CHECK(queue_get_read_elements(&queue, &e) == 3 && e[0].bytes.a == 4 && e[2].bytes.a == 6, "second run");
+    queue_commit_read_elements(&queue, 3);
+    CHECK(queue_get_read_elements(&queue, &e) == 0, "empty");
+}
+
+/*
+ * Model of the hops: the timer ISR puts switch edges and 50 ms pulses into the low level queue, the UI turns an edge
+ * into a button event and that into a fire event for the logic, a pulse into a pulse event. The hardware puts the
+ * battery measurements.
+ */
+#define LL_PRESS    1
+#define LL_PULSE    2
+#define UI_FIRE     3
+#define UI_PULSE    4
+#define HW_MEASURE  5
+
+static Queue ll_queue, btn_queue, ui_queue, hw_queue;
+static QueueElement ll_elements[4], btn_elements[4], ui_elements[4], hw_elements[8];
+static uint16_t fire_pass;
+
+static void _process_ll(QueueElement* e) {
+    if (e->bytes.a == LL_PRESS) {
+        queue_put(&btn_queue, UI_FIRE, 0);
+    } else {
+        queue_put(&ui_queue, UI_PULSE, 0);
+    }
+}
+
+static void _process_btn(QueueElement* e) {
+    queue_put(&ui_queue, e->bytes.a, 0);
+}
+
+static void _process_ui(QueueElement* e) {
+    if (e->bytes.a == UI_FIRE) {
+        fire_pass = passes;
+    }
+}
+
+static void _process_hw(QueueElement* e) {
+}
+
+/**
+ * Takes at most one element of the queue (the loops before the drain).
+ */
+static void _take_one(Queue* queue, void (*process)(QueueElement*)) {
+    QueueElement* e = queue_get_read_element(queue);
+    if (e != 0) {
+        process(e);
+        queue_commit_read(queue);
+    }
+}
+
+/**
+ * Takes all elements of the queue.
+ */
+static void _drain(Queue* queue, void (*process)(QueueElement*)) {
+    QueueElement* e;
+    uint8_t n;
+    uint8_t i;
+    while ((n = queue_get_read_elements(queue, &e)) > 0) {
+        for (i = 0; i < n; i++) {
+            process(e + i);
+        }
+        queue_commit_read_elements(queue, n);
+    }
+}
+
+static void _pass(uint8_t drain) {
+    void (*take)(Queue*, void (*)(QueueElement*)) = drain ? _drain : _take_one;
+    take(&ll_queue, _process_ll);       // ui_input_step()
+    take(&btn_queue, _process_btn);
+    take(&ui_queue, _process_ui);       // logic_loop()
+    take(&hw_queue, _process_hw);
+    passes++;
+}
+
+static void _print_latencies(char* name, Queue* queue) {
+    uint8_t n;
+    printf("test_queue:   %s:", name);
+    for (n = 0; n < QUEUE_LATENCY_BUCKETS; n++) {
+        printf(" %u", queue->latency_histogram[n]);
+    }
+    printf(", max %u\n", queue->max_latency);
+}
+
+/**
+ * Puts the burst (low level events in order, then the measurements), runs the passes till all queues are empty and
+ * returns the passes from the burst till the fire event was handled.
+ */
+static uint16_t _run_burst(char* name, const uint8_t* ll_events, uint8_t measurements, uint8_t drain) {
+    queue_initialize(&ll_queue, 4, ll_elements);
+    queue_initialize(&btn_queue, 4, btn_elements);
+    queue_initialize(&ui_queue, 4, ui_elements);
+    queue_initialize(&hw_queue, 8, hw_elements);
+    passes = 0;
+    fire_pass = 0xFFFF;
+    while (*ll_events) {
+        queue_put(&ll_queue, *ll_events++, 0);
+    }
+    while (measurements--) {
+        queue_put(&hw_queue, HW_MEASURE, 0);
+    }
+    while (queue_get_unread_count(&ll_queue) || queue_get_unread_count(&btn_queue)
+           || queue_get_unread_count(&ui_queue) || queue_get_unread_count(&hw_queue)) {
+        _pass(drain);
+    }
+    printf("test_queue: %s, %s: press to fire on %u passes; waits in passes (<4 <16 .. >=16k)\n",
+           name, drain ? "drained" : "one per pass", fire_pass);
+    _print_latencies("ll", &ll_queue);
+    _print_latencies("btn", &btn_queue);
+    _print_latencies("ui", &ui_queue);
+    _print_latencies("hw", &hw_queue);
+    return fire_pass;
+}
+
+/**
+ * The enqueue to handling times of a burst within one pass (a press, a 50 ms pulse and a battery measurement) and of
+ * a main loop that was blocked for three pulses (e.g. by the UART), before and after the drain.
+ */
+static void test_latency(void) {
+    static const uint8_t burst[] = { LL_PULSE, LL_PRESS, 0 };
+    static const uint8_t blocked[] = { LL_PULSE, LL_PULSE, LL_PULSE, LL_PRESS, 0 };
+    CHECK(_run_burst("burst", burst, 1, 0) == 1, "burst, one per pass");
+    CHECK(_run_burst("burst", burst, 1, 1) == 0, "burst, drained");
+    CHECK(ll_queue.max_latency == 0 && ui_queue.max_latency == 0, "burst, drained: waits");
+    CHECK(_run_burst("blocked", blocked, 2, 0) == 3, "blocked, one per pass");
+    CHECK(_run_burst("blocked", blocked, 2, 1) == 0, "blocked, drained");
+    CHECK(ll_queue.max_latency == 0 && hw_queue.max_latency == 0, "blocked, drained: waits");
+}
+
+int main(void) {
+    test_read_elements();
+    test_latency();
+    if (failures) {
+        printf("test_queue: %u failures\n", failures);
+        return 1;
+    }
+    printf("test_queue: ok\n");
+    return 0;
+}
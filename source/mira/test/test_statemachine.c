@@ -0,0 +1,198 @@
+/*
+    FogDrive (https://github.com/FogDrive/FogDrive)
+    Copyright (C) 2016  Daniel Llin Ferrero
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Host test of the state machine engine with the device tables (logic_states.h). The actions only record their
+ * calls, so the test checks the table layout, the transitions and the order of the actions.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "statemachine.h"
+
+static char action_log[256];
+
+static void _log(const char* name) {
+    if (action_log[0]) {
+        strcat(action_log, " ");
+    }
+    strcat(action_log, name);
+}
+
+static void _enter_firing(void)     { _log("fire_on"); }
+static void _exit_firing(void)      { _log("fire_off"); }
+static void _enter_forced_off(void) { _log("forced_off"); }
+static void _fire_timed_out(void)   { _log("fire_timeout"); }
+static void _enter_coil_fault(void) { _log("coil_fault"); }
+static void _enter_sleeping(void)   { _log("sleeping"); }
+static void _power_up(void)         { _log("power_up"); }
+
+#include "logic_states.h"
+
+#define TRANSITION_COUNT (sizeof(device_transitions) / sizeof(Transition))
+#define MAX_EVENT 32
+
+static StateMachine sm;
+static unsigned failures = 0;
+
+#define CHECK(condition, ...) do { \
+        if (!(condition)) { \
+            printf("%s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__); \
+            printf("\n"); \
+            failures++; \
+        } \
+    } while (0)
+
+/**
+ * Each state's slice of the index holds its transitions only, and all transitions are covered once.
+ */
+static void test_index(void) {
+    uint8_t state;
+    CHECK(device_transition_index[0] == 0, "index does not start at 0");
+    CHECK(device_transition_index[DS_COUNT] == TRANSITION_COUNT, "index does not end at the transition count");
+    for (state = 0; state < DS_COUNT; state++) {
+        uint8_t i, j;
+        CHECK(device_transition_index[state] <= device_transition_index[state + 1], "index of state %u decreases", state);
+        for (i = device_transition_index[state]; i < device_transition_index[state + 1]; i++) {
+            CHECK(device_transitions[i].state == state, "transition %u is not of state %u", i, state);
+            for (j = i + 1; j < device_transition_index[state + 1]; j++) {
+                CHECK(device_transitions[i].event != device_transitions[j].event,
+                    "transitions %u and %u of state %u have the same event", i, j, state);
+            }
+        }
+    }
+}
+
+/**
+ * The indexed lookup finds the same transition as a scan of the whole table does, for each state and event.
+ */
+static void test_lookup_matches_scan(void) {
+    uint8_t state, event;
+    statemachine_init(&sm, device_states, device_transitions, device_transition_index, DS_IDLE);
+    for (state = 0; state < DS_COUNT; state++) {
+        for (event = 0; event < MAX_EVENT; event++) {
+            // reference: the first transition of the state or its nearest ancestor in the whole table
+            const Transition* expected = 0;
+            uint8_t s;
+            for (s = state; expected == 0 && s != STATE_NONE; s = device_states[s].parent) {
+                uint8_t i;
+                for (i = 0; i < TRANSITION_COUNT; i++) {
+                    if (device_transitions[i].state == s && device_transitions[i].event == event) {
+                        expected = &device_transitions[i];
+                        break;
+                    }
+                }
+            }
+            sm.current = state;
+            action_log[0] = 0;
+            uint8_t handled = statemachine_dispatch(&sm, event);
+            CHECK(handled == (expected != 0), "state %u, event %u: handled %u", state, event, handled);
+            if (expected && expected->target != STATE_NONE) {
+                CHECK(sm.current == expected->target, "state %u, event %u: target %u instead of %u",
+                    state, event, sm.current, expected->target);
+            } else {
+                CHECK(sm.current == state, "state %u, event %u: state changed to %u", state, event, sm.current);
+            }
+        }
+    }
+}
+
+/**
+ * Dispatches the event and checks the resulting state and the actions called.
+ */
+static void _step(uint8_t event, uint8_t handled, uint8_t state, const char* actions) {
+    action_log[0] = 0;
+    uint8_t result = statemachine_dispatch(&sm, event);
+    CHECK(result == handled, "event %u: handled %u", event, result);
+    CHECK(sm.current == state, "event %u: state %u instead of %u", event, sm.current, state);
+    CHECK(strcmp(action_log, actions) == 0, "event %u: actions \"%s\" instead of \"%s\"", event, action_log, actions);
+}
+
+static void test_device_sequences(void) {
+    action_log[0] = 0;
+    statemachine_init(&sm, device_states, device_transitions, device_transition_index, DS_IDLE);
+    CHECK(sm.current == DS_IDLE && action_log[0] == 0, "init");
+
+    // puff
+    _step(UI__FIRE_BUTTON_RELEASED, 0, DS_IDLE, "");
+    _step(UI__FIRE_BUTTON_PRESSED, 1, DS_FIRING, "fire_on");
+    CHECK(statemachine_is_in(&sm, DS_ON) && statemachine_is_in(&sm, DS_FIRING), "firing is in DS_ON");
+    CHECK(!statemachine_is_in(&sm, DS_IDLE), "firing is not in DS_IDLE");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_IDLE, "fire_off");
+
+    // low battery
+    _step(UI__FIRE_BUTTON_PRESSED, 1, DS_FIRING, "fire_on");
+    _step(DEV_EV_UNDER_VOLTAGE, 1, DS_FORCED_OFF, "fire_off forced_off");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_LOW_BATTERY, "");
+    _step(UI__FIRE_BUTTON_PRESSED, 1, DS_FIRING, "fire_on");
+
+    // fire timeout (the action after the exit)
+    _step(DEV_EV_FIRE_TIMEOUT, 1, DS_IDLE, "fire_off fire_timeout");
+
+    // coil fault
+    _step(UI__FIRE_BUTTON_PRESSED, 1, DS_FIRING, "fire_on");
+    _step(DEV_EV_COIL_FAULT, 1, DS_COIL_FAULT, "fire_off coil_fault");
+    _step(UI__FIRE_BUTTON_PRESSED, 0, DS_COIL_FAULT, "");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_IDLE, "");
+
+    // switching off while firing (inherited from DS_ON), waking up
+    _step(UI__FIRE_BUTTON_PRESSED, 1, DS_FIRING, "fire_on");
+    _step(UI__SWITCH_OFF, 1, DS_SLEEPING, "fire_off sleeping");
+    CHECK(!statemachine_is_in(&sm, DS_ON), "sleeping is not in DS_ON");
+    _step(UI__FIRE_BUTTON_PRESSED, 0, DS_SLEEPING, "");
+    _step(DEV_EV_WAKE_UP, 1, DS_AWAKENING, "");
+    _step(UI__ABORT_AWAKENING, 1, DS_SLEEPING, "sleeping");
+    _step(DEV_EV_WAKE_UP, 1, DS_AWAKENING, "");
+    _step(UI__SWITCH_ON, 1, DS_IDLE, "power_up");
+
+    // fast fire: firing from the press start on, the confirmation changes nothing, a click switches off
+    _step(UI__FIRE_BUTTON_PRESS_STARTED, 1, DS_FIRING_SPECULATIVE, "fire_on");
+    CHECK(statemachine_is_in(&sm, DS_FIRING), "speculative fire is in DS_FIRING");
+    _step(UI__FIRE_BUTTON_CONFIRMED, 1, DS_FIRING, "");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_IDLE, "fire_off");
+    _step(UI__FIRE_BUTTON_CONFIRMED, 0, DS_IDLE, "");
+    _step(UI__FIRE_BUTTON_PRESS_STARTED, 1, DS_FIRING_SPECULATIVE, "fire_on");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_IDLE, "fire_off");
+    _step(UI__FIRE_BUTTON_PRESS_STARTED, 1, DS_FIRING_SPECULATIVE, "fire_on");
+    _step(DEV_EV_COIL_FAULT, 1, DS_COIL_FAULT, "fire_off coil_fault");
+    _step(UI__FIRE_BUTTON_CONFIRMED, 0, DS_COIL_FAULT, "");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_IDLE, "");
+    _step(UI__FIRE_BUTTON_PRESS_STARTED, 1, DS_FIRING_SPECULATIVE, "fire_on");
+    _step(DEV_EV_FIRE_TIMEOUT, 1, DS_IDLE, "fire_off fire_timeout");
+
+    // fast fire after a forced off, switching off while speculative
+    _step(UI__FIRE_BUTTON_PRESSED, 1, DS_FIRING, "fire_on");
+    _step(DEV_EV_UNDER_VOLTAGE, 1, DS_FORCED_OFF, "fire_off forced_off");
+    _step(UI__FIRE_BUTTON_PRESS_STARTED, 0, DS_FORCED_OFF, "");
+    _step(UI__FIRE_BUTTON_RELEASED, 1, DS_LOW_BATTERY, "");
+    _step(UI__FIRE_BUTTON_PRESS_STARTED, 1, DS_FIRING_SPECULATIVE, "fire_on");
+    _step(UI__SWITCH_OFF, 1, DS_SLEEPING, "fire_off sleeping");
+}
+
+int main(void) {
+    test_index();
+    test_lookup_matches_scan();
+    test_device_sequences();
+    if (failures) {
+        printf("test_statemachine: %u failures\n", failures);
+        return 1;
+    }
+    printf("test_statemachine: ok\n");
+    return 0;
+}
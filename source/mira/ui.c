@@ -19,18 +19,24 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/delay.h>
+#include <util/atomic.h>
 #include "ui.h"
 #include "logic.h"
+#include "hardware.h"
 #include "led.h"
+#include "ui_patterns.h"
 #include "button.h"
+#include "profile.h"
+#include "battery.h"
 #include MCUHEADER
 #ifdef UART_ENABLED
     #include "deviface.h"
 #endif
 
-// Bit mask for switch 0
+// Bit mask for switch 0 (the fire button)
 #define CTRLMAP_SWITCH_0_MASK   (1<<HWMAP_UI_SWITCH_0_IX)
-// Bit mask for all used switches
+// Bit mask for all used switches (up to 8 switches of the switch port, each one runs its own button state machine
+// with the switch's bit index as button index)
 #define ALL_SWITCHES            (1<<HWMAP_UI_SWITCH_0_IX)
 
 // Bit mask for out pin 0 (LED)
@@ -38,30 +44,97 @@
 // Bit mask for all used out pins
 #define OUTPIN_ALL_MASK         (1<<HWMAP_UI_OUTPIN_0_IX)
 
-// Low Level Event codes (for the low_level_event_queue)
-#define LLE_SWITCH_PRESSED 1    // a switch was pressed, switch index in 2nd queue element
-#define LLE_SWITCH_RELEASED 2   // a switch was released, switch index in 2nd queue element
-#define LLE_50MS_PULSE 3        // 50 ms pulse, this event is put in the queue each 50 ms
+// Fast fire: the fire is switched on as soon as the fire button is pressed (not after the click detection time)
+// and stays on if the press is no click; the release of a click switches it off again (so the first click of a
+// gesture fires for its press duration). Selected by the build (fast_fire option of the FogDrive, see
+// site_scons/fogdrive.py), can be changed via the deviface.
+#ifdef UI_FAST_FIRE
+    #define FAST_FIRE_DEFAULT 1
+#else
+    #define FAST_FIRE_DEFAULT 0
+#endif
+
+// Double click battery readout: 1 blinks the state of charge (in 20% steps), 0 the voltage under load (volts and tenths)
+#define UI_BATTERY_READOUT_CHARGE 1
+
+// Number of elements of the queues (must be powers of two, see \ref queue)
+#define UI_EVENT_QUEUE_SIZE         4
+#define UI_URGENT_EVENT_QUEUE_SIZE  8
+#define LOW_LEVEL_EVENT_QUEUE_SIZE  4
+
+// Most urgent events from one switch change and the ticks up to it (e.g. pressed, then released), see ui_input_step()
+#define UI_URGENT_EVENTS_PER_CHANGE 2
+// Urgent events after the last switch change of a pass: the ticks up to now (pressed) and the switch off
+#define UI_URGENT_EVENTS_RESERVED   2
 
 // User interface input queue (which is an external, see @ui.h#Queue ui_input_queue) and its element array
 Queue ui_event_queue;
-QueueElement ui_event_queue_elements[4];
+QueueElement ui_event_queue_elements[UI_EVENT_QUEUE_SIZE];
+// User interface queue for urgent events (external, see @ui.h#Queue ui_urgent_event_queue) and its element array
+Queue ui_urgent_event_queue;
+QueueElement ui_urgent_event_queue_elements[UI_URGENT_EVENT_QUEUE_SIZE];
+
+// Number of 50 ms pulses that could not be sent to the logic so far since the ui_event_queue was congested
+static uint8_t pending_50ms_pulses = 0;
 
 /**
  * Queue that transports low level control events to the ui state machines.
  * It's used locally in this module only.
- * Its elements carry a "Low Level Event" (LLE_*) in byte a. In case the event refers to a switch,
- * the switch index is in byte b.
+ * One element per tick in which any switch changed: the debounced states of all used switches as event code and the
+ * #ui_ticks count at which they changed as event value.
  */
 static Queue low_level_event_queue;
 /**
  * Queue array for #ui_input_queue.
  */
-static QueueElement low_level_event_queue_array[3];
+static QueueElement low_level_event_queue_array[LOW_LEVEL_EVENT_QUEUE_SIZE];
 
-static LED led;
+/**
+ * UI ticks (about 10 ms) counted by the UI timer ISR (wraps around). The ISR only debounces and counts, the LED and
+ * button timelines are caught up to it in the main loop by ui_input_step() (see _run_ticks_till()). The
+ * main loop must not fall behind more than 65535 ticks (about 11 minutes; a blocking deviface output of some
+ * seconds at 4800 baud is fine). Read it atomically in the main loop.
+ */
+static volatile uint16_t ui_ticks = 0;
+// The tick count the LED and button timelines have been run to
+static uint16_t processed_ticks = 0;
+// Latest debounced switch state (each bit represents one switch (bit) from the input register (PIN)), written by the
+// UI timer ISR
+static volatile uint8_t switch_states = 0;
+// Set by the UI timer ISR when the low level event queue was full (a change is lost), cleared by ui_input_step()
+// when it feeds the current states again
+static volatile uint8_t low_level_event_dropped = 0;
+// Debouncing counter bytes (of the UI timer ISR, reset while the tick is stopped)
+static uint8_t ct0 = 0xFF, ct1 = 0xFF;
+// 1 while the UI tick is stopped (nothing to time, see _tick_needed())
+static uint8_t tick_stopped = 0;
+
+// LED channels, stepped in one pass each UI tick: the main LED on compare channel A of the UI timer, the status LED
+// on channel B if the MCU has it free (on while firing, so the main LED is free for the battery warnings) and, if
+// the board has one, a third LED on a software PWM for the coil faults (on the main LED otherwise)
+#define UI_LED_MAIN     0
+#ifdef MCU_UI_PWM_B_CR
+    #define UI_LED_STATUS       1
+    #define UI_LED_HW_COUNT     2
+#else
+    #define UI_LED_HW_COUNT     1
+#endif
+#ifdef HWMAP_UI_SOFT_PWM_LED_IX
+    #define UI_LED_FAULT        UI_LED_HW_COUNT
+    #define UI_LED_COUNT        (UI_LED_HW_COUNT + 1)
+    #define SOFT_PWM_LED_MASK   (1<<HWMAP_UI_SOFT_PWM_LED_IX)
+    static LedSoftPwm soft_pwm;
+#else
+    #define UI_LED_FAULT        UI_LED_MAIN
+    #define UI_LED_COUNT        UI_LED_HW_COUNT
+#endif
+static LED leds[UI_LED_COUNT];
+// Ticks till the next change of any LED (0: no pattern running) and the ticks elapsed since the LEDs were stepped;
+// the LEDs are stepped only when they change (see led_step_all())
+static uint8_t led_wait = 0;
+static uint8_t led_elapsed = 0;
 
-static Button button;
+static Buttons buttons;
 
 static uint8_t ui_local_bools = 0;
 #define LB_PRINT_LED_INFO       1
@@ -69,22 +142,71 @@ static uint8_t ui_local_bools = 0;
 #define LB_LOW_VOLTAGE_DETECTED 4
 #define LB_VERY_LOW_VOLTAGE_DETECTED 8
 #define LB_SWITCH_OFF_FORCED    16
+#define LB_FIRE_SPECULATIVE     32      // fire button press reported to the logic before the click detection (fast fire)
+#define LB_COIL_SHORT           64      // fire off is due to a shorted coil
+#define LB_COIL_OPEN            128     // fire off is due to an open coil
+
+// Set by the LED callback and turned into an UI__SWITCH_OFF event by ui_input_step() (unless awakening).
+static uint8_t shutdown_requested = 0;
+
+// 1 if a fire button release didn't fit into the urgent queue, it's put before any later urgent event
+static uint8_t fire_release_pending = 0;
+
+/**
+ * Restarts the UI tick if it has been stopped.
+ */
+static void _start_tick(void) {
+    if (tick_stopped) {
+        tick_stopped = 0;
+        ct0 = 0xFF;     // (the ISR is stopped, so we can debounce from scratch)
+        ct1 = 0xFF;
+        mcu_restart_ui_timer();
+    }
+}
+
+/**
+ * Catches the LEDs up to the current tick before one of them is changed, and updates the time till their next change
+ * afterwards (see _start_led_pattern() and _set_led_brightness()).
+ */
+static void _leds_catch_up(void) {
+    led_step_all(leds, UI_LED_COUNT, led_elapsed);  // (less than led_wait, so this doesn't change them)
+    led_elapsed = 0;
+}
+static void _leds_changed(void) {
+    led_wait = led_step_all(leds, UI_LED_COUNT, 0);
+    _start_tick();
+}
+
+/**
+ * Starts the LED pattern on the LED with the given index (see led_start_pattern()).
+ */
+static void _start_led_pattern(uint8_t ix, const uint8_t* pattern, uint8_t p0, uint8_t p1, LedPatternCallback callback) {
+    _leds_catch_up();
+    led_start_pattern(&leds[ix], pattern, p0, p1, callback);
+    _leds_changed();
+}
+
+/**
+ * Sets the brightness of the LED with the given index (see led_set_brightness()).
+ */
+static void _set_led_brightness(uint8_t ix, uint8_t brightness) {
+    _leds_catch_up();
+    led_set_brightness(&leds[ix], brightness);
+    _leds_changed();
+}
 
 /**
  * @brief Blends the LED from a value "from" to a value "to".
  */
 void led_blend(void) {
-    led_program_reset(&led);
-    led_program_add_brightness(&led, 0);
-    led_program_add_linear_dim(&led, 99, 50);
-    led_program_add_brightness(&led, 0);
-    led_start_program(&led);
+    _start_led_pattern(UI_LED_MAIN, led_pattern_blend, 0, 0, 0);
 }
 
 uint8_t ui_init(void) {
     // init queues
-    queue_initialize(&ui_event_queue, 4, ui_event_queue_elements);
-    queue_initialize(&low_level_event_queue, 3, low_level_event_queue_array);
+    queue_initialize(&ui_event_queue, UI_EVENT_QUEUE_SIZE, ui_event_queue_elements);
+    queue_initialize(&ui_urgent_event_queue, UI_URGENT_EVENT_QUEUE_SIZE, ui_urgent_event_queue_elements);
+    queue_initialize(&low_level_event_queue, LOW_LEVEL_EVENT_QUEUE_SIZE, low_level_event_queue_array);
 
     // init switch pins
     HWMAP_UI_SWITCH_DDR &= ~ALL_SWITCHES;                // configure all input pins as input by setting the related direction bits to 0
@@ -99,10 +221,17 @@ uint8_t ui_init(void) {
 
     // init LED PWM
     mcu_init_ui_double_compare_timer_for_fast_pwm_1ms();
-    led_init_led(&led, &MCU_UI_PWM_A_CR);
+    led_init_led(&leds[UI_LED_MAIN], &MCU_UI_PWM_A_CR);
+    #ifdef UI_LED_STATUS
+    led_init_led(&leds[UI_LED_STATUS], &MCU_UI_PWM_B_CR);
+    #endif
+    #ifdef SOFT_PWM_LED_MASK
+    led_init_led(&leds[UI_LED_FAULT], &soft_pwm.compare);
+    #endif
 
     // init button logic
-    button_init(&button);
+    buttons_init(&buttons);
+    buttons_report_press_start(&buttons, HWMAP_UI_SWITCH_0_IX, FAST_FIRE_DEFAULT);
 
     led_blend();
 
@@ -110,21 +239,33 @@ uint8_t ui_init(void) {
 }
 
 /**
-  * ISR for timer zero.
-  * Configured to be called every 10ms.
+  * ISR for the overflow of timer zero (the LED PWM timer).
+  * Does its work each HWMAP_UI_TIMER_OVERFLOWS_PER_TICK-th overflow, which is about every 10ms (except for the
+  * LED dithering and the software PWM, which are done on each overflow): debouncing and counting the #ui_ticks.
+  * Everything else is done in the main loop (see ui_input_step()) to keep the ISR short.
   */
 ISR( HWMAP_UI_TIMER_ISR ) {
-    // initialize the timer again to get the wanted trigger frequency for this ISR
-    HWMAP_UI_TIMER_CMD_REINIT_FOR_10ms;
+    PROFILE_BEGIN(PROF_UI_TIMER_ISR);
+    static uint8_t overflow_counter = 0;
+    #if LED_DITHERING
+    led_dither_all(leds, UI_LED_COUNT);
+    #endif
+    #ifdef SOFT_PWM_LED_MASK
+    if (led_soft_pwm_step(&soft_pwm)) {
+        HWMAP_UI_OUTPIN_PORT |= SOFT_PWM_LED_MASK;
+    } else {
+        HWMAP_UI_OUTPIN_PORT &= ~SOFT_PWM_LED_MASK;
+    }
+    #endif
+    if (++overflow_counter < HWMAP_UI_TIMER_OVERFLOWS_PER_TICK) {
+        PROFILE_END(PROF_UI_TIMER_ISR);
+        return;
+    }
+    overflow_counter = 0;
+    uint16_t ticks = ++ui_ticks;
 
-    // debouncing counter bytes
-    static uint8_t ct0 = 0xFF, ct1 = 0xFF;
-    // latest debounced switch state (each bit represents one switch (bit) from the input register (PIN))
-    static uint8_t switch_states = 0;
     // latest changed status (1 = changed, 0 = unchanged, each bit represents one switch (bit) from the input register (PIN))
     static uint8_t changed_switches = 0;
-    // counter that just counts to five times and is resetted then to identify each 5th cycle of the 10ms branch
-    static uint8_t _50ms_counter = 0;
     // stores the difference of the main cycle counter between each call and the former of this ISR
     static uint8_t last_main_cycle_counter = 0;
 
@@ -144,150 +285,296 @@ ISR( HWMAP_UI_TIMER_ISR ) {
     // create a bitmask of all _relevant_ switches that have changed
     changed_switches = i & ALL_SWITCHES;
 
-    // check for concrete switch changes:
-    // check for switch 0
-    if (CTRLMAP_SWITCH_0_MASK & changed_switches) {
-        QueueElement* e = queue_get_write_element(&low_level_event_queue);
-        if (CTRLMAP_SWITCH_0_MASK & switch_states) {
-            e->bytes.a = LLE_SWITCH_PRESSED;
-        } else {
-            e->bytes.a = LLE_SWITCH_RELEASED;
+    // hand the new states of all switches over to the button state machines at once (in the main loop)
+    if (changed_switches) {
+        if (CTRLMAP_SWITCH_0_MASK & changed_switches) {
+            if (CTRLMAP_SWITCH_0_MASK & switch_states) {
+                PROFILE_MARK(PROF_FIRE_LATENCY);
+            } else {
+                PROFILE_UNMARK(PROF_FIRE_LATENCY);
+            }
+        }
+        if (queue_put_value(&low_level_event_queue, switch_states & ALL_SWITCHES, ticks) == QUEUE_DROPPED) {
+            low_level_event_dropped = 1;
         }
-        e->bytes.b = HWMAP_UI_SWITCH_0_IX;
-    }
-
-    if (++_50ms_counter == 5) {
-        _50ms_counter = 0;
-        QueueElement* e = queue_get_write_element(&low_level_event_queue);
-        e->bytes.a = LLE_50MS_PULSE;
     }
 
-    led_step(&led);
-}
-
-void _print_led_commands(LED* led) {
-#ifdef UART_ENABLED
-    uint8_t n = 0;
-    for (n = 0; n < _LED_MAX_COMMAND_COUNT; n++) {
-        deviface_putstring("  ");
-        deviface_put_uint8(led->_commands[n].cmd);
-        deviface_putstring(" ");
-        deviface_put_uint8(led->_commands[n].generic.a);
-        deviface_putstring(" ");
-        deviface_put_uint8(led->_commands[n].generic.b);
-        deviface_putstring(" ");
-        deviface_put_uint8(led->_commands[n].generic.c);
-        deviface_putlineend();
-    }
-#endif
+    PROFILE_END(PROF_UI_TIMER_ISR);
 }
 
 void _callback_for_shutdown(LED *led) {
     // we are switched on (awake) and switch off now (go to sleep)
-    QueueElement* e = queue_get_write_element(&ui_event_queue);
-    e->bytes.a = UI__SWITCH_OFF;
+    // (we just leave a note for ui_input_step, which holds it back while awakening)
+    shutdown_requested = 1;
 }
 
-void ui_input_step(void) {
+/**
+ * Runs the LED and button timelines till the given tick count (the bottom half of the UI timer ISR).
+ */
+static void _run_ticks_till(uint16_t ticks) {
+    // counter that just counts to five times and is resetted then to identify each 5th tick
+    static uint8_t _50ms_counter = 0;
+    while (processed_ticks != ticks) {
+        ++processed_ticks;
+
+        if (led_wait != 0) {
+            ++led_elapsed;
+            if (--led_wait == 0) {
+                PROFILE_BEGIN(PROF_LED_STEP);
+                led_wait = led_step_all(leds, UI_LED_COUNT, led_elapsed);
+                led_elapsed = 0;
+                PROFILE_END(PROF_LED_STEP);
+            }
+        }
 
-    // Check for events from the timer ISR and react
-    QueueElement* low_level_event_e = queue_get_read_element(&low_level_event_queue);
-    if (low_level_event_e != 0) {
-        if (low_level_event_e->bytes.a == LLE_SWITCH_PRESSED) {
-            button_pressed(&button);
+        if (++_50ms_counter == 5) {
+            _50ms_counter = 0;
+            // The pulses are the least important UI events. We keep the last free queue element for other events
+            // and collapse the pulses into one event while the queue is congested.
+            if (pending_50ms_pulses < 255) {
+                ++pending_50ms_pulses;
+            }
+            if (queue_get_unread_count(&ui_event_queue) < UI_EVENT_QUEUE_SIZE - 1) {
+                queue_put(&ui_event_queue, UI__50MS_PULSE, pending_50ms_pulses);
+                pending_50ms_pulses = 0;
+            }
+            buttons_step(&buttons);
         }
-        else if (low_level_event_e->bytes.a == LLE_SWITCH_RELEASED) {
-            button_released(&button);
+    }
+}
+
+/**
+ * Puts an urgent event for the logic. A fire button release that is dropped stays pending till there is room again,
+ * a press in the meantime is dropped (so the fire can't stay on).
+ */
+static void _put_urgent_event(uint8_t code) {
+    if (fire_release_pending) {
+        if (queue_put(&ui_urgent_event_queue, UI__FIRE_BUTTON_RELEASED, 0) == QUEUE_DROPPED) {
+            return;
         }
-        else if (low_level_event_e->bytes.a == LLE_50MS_PULSE) {
-            QueueElement* e = queue_get_write_element(&ui_event_queue);
-            e->bytes.a = UI__50MS_PULSE;
-            button_step(&button);
+        fire_release_pending = 0;
+        if (code == UI__FIRE_BUTTON_RELEASED) {
+            return;
         }
     }
+    if (queue_put(&ui_urgent_event_queue, code, 0) == QUEUE_DROPPED && code == UI__FIRE_BUTTON_RELEASED) {
+        fire_release_pending = 1;
+    }
+}
 
-    // Check for events from the button and react
-    if (global_state == GS_AWAKENING) {
-        QueueElement* button_event = queue_get_read_element(&(button.button_event_queue));
-        if (button_event != 0) {
-            if (button_event->bytes.a == BUTTON_EVENT_CLICK & button_event->bytes.b == 3) {
-                QueueElement* e = queue_get_write_element(&ui_event_queue);
-                e->bytes.a = UI__SWITCH_ON;
+/**
+ * Returns 1 if the urgent queue has room for the events of one more switch change (and those reserved for the rest of
+ * the pass).
+ */
+static uint8_t _urgent_room_for_change(void) {
+    return UI_URGENT_EVENT_QUEUE_SIZE - queue_get_unread_count(&ui_urgent_event_queue)
+        >= UI_URGENT_EVENTS_PER_CHANGE + UI_URGENT_EVENTS_RESERVED;
+}
+
+/**
+ * Processes a single low level event from the timer ISR.
+ */
+static void _process_low_level_event(QueueElement* low_level_event_e) {
+    // the timelines up to the tick before the event, then the new states, then the tick of the event (the ISR has
+    // debounced the states before the tick's step)
+    uint16_t ticks = low_level_event_e->event.value;
+    _run_ticks_till(ticks - 1);
+    buttons_set_states(&buttons, low_level_event_e->event.code);
+    _run_ticks_till(ticks);
+}
+
+/**
+ * Processes a single event from the buttons.
+ */
+static void _process_button_event(QueueElement* button_event) {
+    uint8_t code = BUTTON_EVENT_CODE(button_event->bytes.a);
+    if (BUTTON_EVENT_BUTTON(button_event->bytes.a) != HWMAP_UI_SWITCH_0_IX) {
+        return;         // (only the fire button is used so far)
+    }
+    if (logic_device_is_in(DS_AWAKENING)) {
+        if (code == BUTTON_EVENT_PRESS_STARTED || code == BUTTON_EVENT_PRESS_CANCELED) {
+            return;     // no fast fire while awakening, wait for the click
+        }
+        if (code == BUTTON_EVENT_CLICK & button_event->bytes.b == 3) {
+            queue_put(&ui_event_queue, UI__SWITCH_ON, 0);
+        } else {
+            queue_put(&ui_event_queue, UI__ABORT_AWAKENING, 0);
+        }
+        return;
+    }
+    switch (code) {
+        case BUTTON_EVENT_PRESS_STARTED: {
+            // fast fire: fire right now, it's switched off at the release if this becomes a click
+            ui_local_bools |= LB_FIRE_SPECULATIVE;
+            _put_urgent_event(UI__FIRE_BUTTON_PRESS_STARTED);
+            break;
+        }
+        case BUTTON_EVENT_PRESS_CANCELED: {
+            ui_local_bools &= ~LB_FIRE_SPECULATIVE;
+            _put_urgent_event(UI__FIRE_BUTTON_RELEASED);
+            break;
+        }
+        case BUTTON_EVENT_PRESSED: {
+            // button pressed: fire! (fast fire confirms the fire that is on already)
+            if (ui_local_bools & LB_FIRE_SPECULATIVE) {
+                ui_local_bools &= ~LB_FIRE_SPECULATIVE;
+                _put_urgent_event(UI__FIRE_BUTTON_CONFIRMED);
             } else {
-                QueueElement* e = queue_get_write_element(&ui_event_queue);
-                e->bytes.a = UI__ABORT_AWAKENING;
+                _put_urgent_event(UI__FIRE_BUTTON_PRESSED);
             }
+            break;
         }
-
-    } else {
-        QueueElement* button_event = queue_get_read_element(&(button.button_event_queue));
-        if (button_event != 0) {
-            switch (button_event->bytes.a) {
-                case BUTTON_EVENT_PRESSED: {
-                    // button pressed: fire!
-                    QueueElement* e = queue_get_write_element(&ui_event_queue);
-                    e->bytes.a = UI__FIRE_BUTTON_PRESSED;
-                    break;
-                }
-                case BUTTON_EVENT_RELEASED_TIMEOUT: {
+        case BUTTON_EVENT_RELEASED_TIMEOUT: {
+            led_blend();
+            break;
+        }
+        case BUTTON_EVENT_RELEASED: {
+            //button released: fire off!
+            _put_urgent_event(UI__FIRE_BUTTON_RELEASED);
+            break;
+        }
+        case BUTTON_EVENT_CLICK: {
+            // click sequence detected
+            switch (button_event->bytes.b) {
+                case 1:
+                {
                     led_blend();
                     break;
                 }
-                case BUTTON_EVENT_TIMEOUT:
-                case BUTTON_EVENT_RELEASED: {
-                    //button released: fire off!
-                    QueueElement* e = queue_get_write_element(&ui_event_queue);
-                    e->bytes.a = UI__FIRE_BUTTON_RELEASED;
-                    break;
-                }
-                case BUTTON_EVENT_CLICK: {
-                    // click sequence detected
-                    switch (button_event->bytes.b) {
-                        case 1:
-                        {
-                            led_blend();
-                            break;
-                        }
 
-                        case 2:
-                        {
-                            if (battery_voltage_under_load > 0) {
-                                // double click detected: "blink" the battery voltage under load
-                                uint8_t digit1 = battery_voltage_under_load / 10;
-                                uint8_t digit2 = battery_voltage_under_load - digit1*10;
-                                led_set_brightness(&led, 0);
-                                led_program_reset(&led);
-                                led_program_add_linear_dim(&led, 99, 3);
-                                led_program_add_hold(&led, 13);
-                                led_program_add_linear_dim(&led, 0, 3);
-                                led_program_add_hold(&led, 20);
-                                led_program_repeat(&led, 0, digit1 - 1);
-                                led_program_add_hold(&led,45);
-                                if (digit2 > 0) {
-                                    led_program_add_linear_dim(&led, 99, 3);
-                                    led_program_add_hold(&led, 13);
-                                    led_program_add_linear_dim(&led, 0, 3);
-                                    led_program_add_hold(&led, 20);
-                                    if (digit2 > 1) {
-                                        led_program_repeat(&led, 6, digit2 - 1);
-                                    }
-                                }
-                                led_start_program(&led);
-                            }
-                            break;
-                        }
-                        case 3:
-                        {
-                            led_program_reset(&led);
-                            led_program_add_brightness(&led, 99);
-                            led_program_add_linear_dim(&led, 0, 50);
-                            led_program_add_brightness(&led, 0);
-                            led_program_callback(&led, _callback_for_shutdown);
-                            led_start_program(&led);
+                case 2:
+                {
+                    #if UI_BATTERY_READOUT_CHARGE
+                    uint16_t charge = battery_get_state_of_charge();
+                    if (charge != BATTERY_UNKNOWN) {
+                        // double click detected: blink the state of charge, one short blink per started 20%
+                        uint8_t blinks = (charge + 19) / 20;
+                        if (blinks == 0) {
+                            blinks = 1;
                         }
+                        _start_led_pattern(UI_LED_MAIN, led_pattern_charge, blinks, 0, 0);
+                        break;
+                    }
+                    #endif
+                    if (battery_voltage_under_load > 0) {
+                        // double click detected: "blink" the battery voltage under load
+                        uint8_t digit1 = battery_voltage_under_load / 1000;                   // volts
+                        uint8_t digit2 = (battery_voltage_under_load - digit1*1000U) / 100;   // tenths of a volt
+                        _start_led_pattern(UI_LED_MAIN, led_pattern_voltage, digit1, digit2, 0);
                     }
                     break;
                 }
+                case 3:
+                {
+                    _start_led_pattern(UI_LED_MAIN, led_pattern_shutdown, 0, 0, _callback_for_shutdown);
+                }
+            }
+            break;
+        }
+    }
+}
+
+/**
+ * Returns 1 if the predicted firing time left is below the given seconds, or, as long as there is no prediction,
+ * if the battery voltage under load is below the given voltage.
+ */
+static uint8_t _battery_is_low(uint16_t seconds_left, uint16_t millivolts) {
+    if (battery_seconds_left != BATTERY_UNKNOWN) {
+        return battery_seconds_left < seconds_left;
+    }
+    return battery_voltage_under_load < millivolts;
+}
+
+/**
+ * Returns 1 if anything needs the UI tick: an LED pattern, the dithering or the software PWM, a switch changing its
+ * state, a button click sequence or the logic (50 ms pulses).
+ */
+static uint8_t _tick_needed(void) {
+    uint8_t i;
+    if (
+        led_wait != 0
+        || ((switch_states ^ ~HWMAP_UI_SWITCH_PIN) & ALL_SWITCHES)
+        || !buttons_are_idle(&buttons)
+        || pending_50ms_pulses != 0
+        || logic_wants_pulses()
+        #ifdef SOFT_PWM_LED_MASK
+        || soft_pwm.compare != 0xFF
+        #endif
+    ) {
+        return 1;
+    }
+    #if LED_DITHERING
+    for (i = 0; i < UI_LED_COUNT; i++) {
+        if (led_is_dithering(&leds[i])) {
+            return 1;
+        }
+    }
+    #endif
+    return 0;
+}
+
+/**
+ * Processes all pending button events.
+ */
+static void _process_button_events(void) {
+    QueueElement* e;
+    uint8_t n;
+    uint8_t i;
+    while ((n = queue_get_read_elements(&(buttons.button_event_queue), &e)) > 0) {
+        for (i = 0; i < n; i++) {
+            _process_button_event(e + i);
+        }
+        queue_commit_read_elements(&(buttons.button_event_queue), n);
+    }
+}
+
+void ui_input_step(void) {
+    QueueElement* e;
+    uint8_t n;
+    uint8_t i;
+
+    if (fire_release_pending) {
+        _put_urgent_event(UI__FIRE_BUTTON_RELEASED);
+    }
+
+    // Check for the pending events from the timer ISR one switch change at a time and react, then run the timelines
+    // to the current tick (taken together with an empty queue, so a later event never has an older tick than the
+    // processed ones). If the urgent queue is short of room, the rest follows in the next pass, after the logic has
+    // taken the urgent events.
+    uint16_t ticks;
+    uint8_t dropped = 0;
+    uint8_t states = 0;
+    do {
+        while (_urgent_room_for_change() && (e = queue_get_read_element(&low_level_event_queue)) != 0) {
+            _process_low_level_event(e);
+            queue_commit_read(&low_level_event_queue);
+            _process_button_events();
+        }
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            ticks = ui_ticks;
+            n = queue_get_unread_count(&low_level_event_queue);
+            if (n == 0) {
+                dropped = low_level_event_dropped;
+                low_level_event_dropped = 0;
+                states = switch_states & ALL_SWITCHES;
+            }
+        }
+    } while (n > 0 && _urgent_room_for_change());
+    if (n == 0) {
+        _run_ticks_till(ticks);
+        if (dropped) {
+            // the queue was full (e.g. while the main loop was blocked) and the latest change is lost: feed the
+            // current states again (the buttons only take the changed ones), so a release can't get stuck
+            buttons_set_states(&buttons, states);
+        }
+        _process_button_events();
+    }
+
+    if (!logic_device_is_in(DS_AWAKENING)) {
+        // Check for a shutdown requested by the LED program
+        if (shutdown_requested) {
+            if (queue_put(&ui_urgent_event_queue, UI__SWITCH_OFF, 0) != QUEUE_DROPPED) {
+                shutdown_requested = 0;
             }
         }
 
@@ -295,63 +582,115 @@ void ui_input_step(void) {
         #ifdef UART_ENABLED
         if (ui_local_bools & LB_PRINT_LED_INFO) {
             ui_local_bools &= ~LB_PRINT_LED_INFO;
-            deviface_putstring("LED 1# b: ");
-            deviface_put_uint8(led._current_brightness);
-            deviface_putstring(", ocr: ");
-            deviface_put_uint8(MCU_UI_PWM_A_CR);
-            deviface_putstring(", ccnt: ");
-            deviface_put_uint8(led._command_count);
-            deviface_putstring(", cix: ");
-            deviface_put_uint8(led._current_command_ix);
-            deviface_putlineend();
-            _print_led_commands(&led);
+            for (i = 0; i < UI_LED_COUNT; i++) {
+                LED* led = &leds[i];
+                deviface_putstring("LED ");
+                deviface_put_uint8(i + 1);
+                deviface_putstring("# b: ");
+                deviface_put_uint8(led->_current_brightness);
+                deviface_putstring(", ocr: ");
+                deviface_put_uint8(*(led->_compare_register_address));
+                deviface_putstring(", pattern: ");
+                deviface_put_uint16((uint16_t)led->_pattern);
+                deviface_putstring(", pc: ");
+                deviface_put_uint8(led->_pc);
+                deviface_putstring(", step: ");
+                deviface_put_uint8(led->_step_count);
+                deviface_putstring(", params: ");
+                deviface_put_uint8(led->_params[0]);
+                deviface_putstring(" ");
+                deviface_put_uint8(led->_params[1]);
+                deviface_putstring(", loops: ");
+                deviface_put_uint8(led->_loop_counters[0]);
+                deviface_putstring(" ");
+                deviface_put_uint8(led->_loop_counters[1]);
+                deviface_putlineend();
+            }
         }
         #endif
 
-        // Battery voltage indicator
+        // Battery indicator
         if (ui_local_bools & LB_FIRE_IS_ON) {
             if (battery_voltage_under_load > 0) {
-                if (battery_voltage_under_load < BATTERY_VOLTAGE_LOW_VALUE) {
+                if (_battery_is_low(BATTERY_SECONDS_LEFT_LOW, BATTERY_VOLTAGE_LOW_VALUE)) {
                     if (! (ui_local_bools & LB_LOW_VOLTAGE_DETECTED)) {
                         ui_local_bools |= LB_LOW_VOLTAGE_DETECTED;
-                        led_program_reset(&led);
-                        led_program_add_linear_dim(&led, 87, 20);
-                        led_start_program(&led);
+                        _start_led_pattern(UI_LED_MAIN, led_pattern_low_battery, 0, 0, 0);
                     }
                 }
-                if (battery_voltage_under_load < BATTERY_VOLTAGE_VERY_LOW_VALUE) {
+                if (_battery_is_low(BATTERY_SECONDS_LEFT_VERY_LOW, BATTERY_VOLTAGE_VERY_LOW_VALUE)) {
                     if (! (ui_local_bools & LB_VERY_LOW_VOLTAGE_DETECTED)) {
                         ui_local_bools |= LB_VERY_LOW_VOLTAGE_DETECTED;
-                        led_program_reset(&led);
-                        led_program_add_linear_dim(&led, 99, 10);
-                        led_program_add_hold(&led,22);
-                        led_program_add_linear_dim(&led, 0, 10);
-                        led_program_add_hold(&led,8);
-                        led_program_repeat(&led,0,0);
-                        led_start_program(&led);
+                        _start_led_pattern(UI_LED_MAIN, led_pattern_very_low_battery, 0, 0, 0);
                     }
                 }
             }
         }
     }
+
+    // Stop the UI tick while there is nothing to time (a pin change of a switch wakes us up), restart it otherwise
+    // (if the logic needs it later on in this main loop cycle, ui_is_idle() keeps the main loop awake for that)
+    if (tick_stopped) {
+        if (_tick_needed()) {
+            _start_tick();
+        }
+    } else if (!_tick_needed()) {
+        mcu_stop_ui_timer_till_pin_change();
+        tick_stopped = 1;
+        #ifdef SOFT_PWM_LED_MASK
+        HWMAP_UI_OUTPIN_PORT &= ~SOFT_PWM_LED_MASK; // (the software PWM may have left it on in its last period)
+        #endif
+        if ((switch_states ^ ~HWMAP_UI_SWITCH_PIN) & ALL_SWITCHES) {
+            _start_tick();                          // changed before the pin change interrupt was enabled
+        }
+    }
+}
+
+uint8_t ui_is_idle(void) {
+    uint16_t ticks;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        ticks = ui_ticks;
+    }
+    return queue_get_unread_count(&low_level_event_queue) == 0
+        && !(tick_stopped && _tick_needed())
+        && queue_get_unread_count(&(buttons.button_event_queue)) == 0
+        && processed_ticks == ticks
+        && shutdown_requested == 0
+        && fire_release_pending == 0
+        && (ui_local_bools & LB_PRINT_LED_INFO) == 0;
 }
 
 void ui_fire_is_on(void) {
     ui_local_bools |= LB_FIRE_IS_ON;
+    #ifdef UI_LED_STATUS
+    _set_led_brightness(UI_LED_STATUS, 99);
+    #endif
+    #ifdef SOFT_PWM_LED_MASK
+    _set_led_brightness(UI_LED_FAULT, 0);           // (a fault of the last fire is over)
+    #endif
 }
 
 void ui_fire_is_off(void) {
     ui_local_bools &= ~LB_FIRE_IS_ON;
     ui_local_bools &= ~LB_LOW_VOLTAGE_DETECTED;
     ui_local_bools &= ~LB_VERY_LOW_VOLTAGE_DETECTED;
-    led_set_brightness(&led, 0);
+    _set_led_brightness(UI_LED_MAIN, 0);
+    #ifdef UI_LED_STATUS
+    _set_led_brightness(UI_LED_STATUS, 0);
+    #endif
     if (ui_local_bools & LB_SWITCH_OFF_FORCED) {
         ui_local_bools &= ~ LB_SWITCH_OFF_FORCED;
-        led_program_reset(&led);
-        led_program_add_linear_dim(&led, 99, 10);
-        led_program_add_linear_dim(&led, 0, 10);
-        led_program_repeat(&led,0,0);
-        led_start_program(&led);
+        _start_led_pattern(UI_LED_MAIN, led_pattern_forced_off, 0, 0, 0);
+    }
+    if (ui_local_bools & LB_COIL_SHORT) {
+        // flicker for 2s
+        ui_local_bools &= ~LB_COIL_SHORT;
+        _start_led_pattern(UI_LED_FAULT, led_pattern_coil_short, 0, 0, 0);
+    }
+    if (ui_local_bools & LB_COIL_OPEN) {
+        // three long blinks
+        ui_local_bools &= ~LB_COIL_OPEN;
+        _start_led_pattern(UI_LED_FAULT, led_pattern_coil_open, 0, 0, 0);
     }
 }
 
@@ -359,13 +698,70 @@ void ui_switch_off_forced(void) {
     ui_local_bools |= LB_SWITCH_OFF_FORCED;
 }
 
+void ui_fire_timeout(void) {
+    buttons_timeout(&buttons, HWMAP_UI_SWITCH_0_IX);
+}
+
+void ui_coil_fault(uint8_t fault) {
+    ui_local_bools |= (fault == HW_COIL_SHORT) ? LB_COIL_SHORT : LB_COIL_OPEN;
+}
+
 void ui_print_led_info(void) {
     ui_local_bools |= LB_PRINT_LED_INFO;
 }
 
+void ui_print_queue_info(void) {
+#ifdef UART_ENABLED
+    deviface_put_queue_statistics("ll", &low_level_event_queue);
+    deviface_put_queue_statistics("btn", &(buttons.button_event_queue));
+#endif
+}
+
+void ui_reset_queue_statistics(void) {
+    queue_reset_statistics(&low_level_event_queue);
+    queue_reset_statistics(&(buttons.button_event_queue));
+}
+
+#ifdef QUEUE_LATENCY_STATISTICS
+void ui_print_queue_latency_info(void) {
+    deviface_put_queue_latency_statistics("ll", &low_level_event_queue);
+    deviface_put_queue_latency_statistics("btn", &(buttons.button_event_queue));
+}
+
+void ui_reset_queue_latency_statistics(void) {
+    queue_reset_latency_statistics(&low_level_event_queue);
+    queue_reset_latency_statistics(&(buttons.button_event_queue));
+}
+#endif
+
+#ifdef UART_ENABLED
+static void _command_fast_fire_on(void) {
+    buttons_report_press_start(&buttons, HWMAP_UI_SWITCH_0_IX, 1);
+}
+
+static void _command_fast_fire_off(void) {
+    buttons_report_press_start(&buttons, HWMAP_UI_SWITCH_0_IX, 0);
+}
+
+static const DevifaceCommand ui_commands[] PROGMEM = {
+    {"ui leds", ui_print_led_info,      "print the LED state"},
+    {"ff on",   _command_fast_fire_on,  "fire at once when pressed, clicks fire briefly"},
+    {"ff off",  _command_fast_fire_off, "fire after click detection"},
+};
+const DevifaceCommandTable ui_deviface_commands PROGMEM = DEVIFACE_COMMAND_TABLE(ui_commands);
+#endif
+
 void ui_power_down() {
-    led_set_brightness(&led, 0);    // cancel any LED program if some is running and switch off the LED
+    uint8_t i;
+    for (i = 0; i < UI_LED_COUNT; i++) {
+        _set_led_brightness(i, 0);    // cancel any LED program if some is running and switch off the LED
+    }                                       // (the software PWM switches its pin off during the delay below)
+    shutdown_requested = 0;
     queue_clear(&ui_event_queue);   // remove unprocessed UI events if there are any
+    queue_clear(&ui_urgent_event_queue);
+    fire_release_pending = 0;
+    pending_50ms_pulses = 0;
+    ui_local_bools &= ~LB_FIRE_SPECULATIVE;
     _delay_ms(100);
     // the UI timer ISR is just freezed as it is
 }
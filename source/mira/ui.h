@@ -21,20 +21,37 @@
 #include <avr/io.h>
 #include "queue.h"
 
-#define UI__FIRE_BUTTON_PRESSED 1
-#define UI__FIRE_BUTTON_RELEASED 2
-#define UI__50MS_PULSE          3
-#define UI__SWITCH_OFF          4
+// UI events; the ones marked as urgent are sent via the ui_urgent_event_queue, all others via the ui_event_queue
+#define UI__FIRE_BUTTON_PRESSED 1   // urgent
+#define UI__FIRE_BUTTON_RELEASED 2  // urgent
+#define UI__50MS_PULSE          3   // number of (collapsed) 50 ms pulses in second byte
+#define UI__SWITCH_OFF          4   // urgent
 #define UI__SWITCH_ON           5
 #define UI__ABORT_AWAKENING     6
+#define UI__FIRE_BUTTON_PRESS_STARTED 7     // urgent, fast fire: fire at once, the press may still become a click
+#define UI__FIRE_BUTTON_CONFIRMED 8 // urgent, fast fire: the started press is no click (instead of UI__FIRE_BUTTON_PRESSED)
+
+#ifdef UART_ENABLED
+    #include "deviface.h"
+    // developer interface commands of the ui module
+    extern const DevifaceCommandTable ui_deviface_commands;
+#endif
 
 // A queue that transports user interface inputs (low level command from the user) to the logic module
 extern Queue ui_event_queue;
 
+// A queue for the UI events that must not wait behind others (firing and switching off).
+// The logic processes its events before any event of the ui_event_queue.
+// (Fire on goes this way as well to keep it in order with fire off.)
+extern Queue ui_urgent_event_queue;
+
 uint8_t ui_init(void);
 
 void ui_input_step(void);
 
+// Returns 1 if ui_input_step() has nothing to do till the next interrupt (so the main loop may sleep)
+uint8_t ui_is_idle(void);
+
 void ui_power_down(void);
 
 void ui_power_up(void);
@@ -45,6 +62,22 @@ void ui_fire_is_off(void);
 
 void ui_print_led_info(void);
 
+void ui_print_queue_info(void);
+
+void ui_reset_queue_statistics(void);
+
+#ifdef QUEUE_LATENCY_STATISTICS
+void ui_print_queue_latency_info(void);
+
+void ui_reset_queue_latency_statistics(void);
+#endif
+
 void ui_switch_off_forced(void);
 
+// The fire timeout has switched off firing: the rest of the press is handled like a button timeout
+void ui_fire_timeout(void);
+
+// Shows the coil fault (HW_COIL_SHORT or HW_COIL_OPEN) when firing is switched off
+void ui_coil_fault(uint8_t fault);
+
 #endif // UI_H
@@ -0,0 +1,68 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#FogDrive (https://github.com/FogDrive/FogDrive)
+#Copyright (C) 2016  Daniel Llin Ferrero
+
+#This program is free software: you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation, either version 3 of the License, or
+#(at your option) any later version.
+
+#This program is distributed in the hope that it will be useful,
+#but WITHOUT ANY WARRANTY; without even the implied warranty of
+#MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#GNU General Public License for more details.
+
+#You should have received a copy of the GNU General Public License
+#along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+
+from __future__ import division, print_function
+import argparse
+
+
+parser = argparse.ArgumentParser(
+    prog='adctable',
+    usage='%(prog)s [options]\nPrints a C array that maps the (oversampled) ADC value of the band gap measurement to the supply voltage in mV.\n' \
+          'This script is used to create the battery voltage table for FogDrive (see hardware.c).'
+)
+
+parser.add_argument('-r', '--reference',  type=int, default=1100, help="Band gap reference voltage in mV (default 1100)")
+parser.add_argument('-s', '--oversampling-bits', type=int, default=0, help="Extra bits of the decimated ADC value (default 0)")
+parser.add_argument('-l', '--low',        type=int, required=True, help="Lowest voltage of the table in mV")
+parser.add_argument('-u', '--high',       type=int, required=True, help="Highest voltage of the table in mV")
+parser.add_argument('-k', '--shift',      type=int, required=True, help="Distance of the table entries as power of two (in decimated ADC steps)")
+
+args = parser.parse_args()
+
+assert args.low < args.high
+
+# The ADC measures the band gap reference against V_CC: adc = 1024 * V_BG / V_CC (with 2^s fractional steps)
+scale = args.reference * 1024 * 2**args.oversampling_bits
+step = 2**args.shift
+
+def millivolts(adc_value):
+    return scale / adc_value
+
+# high voltage -> low ADC value; the first entry is at or above the highest voltage, the last at or below the lowest
+first = int(scale / args.high) // step * step
+last = -(-int(scale / args.low + 0.999999) // step) * step
+values = [millivolts(x) for x in range(first, last + step, step)]
+
+number_of_values_per_row = 8
+tab_length = 5
+
+print("#define BVM_TABLE_FIRST {f}    // {v} mV".format(f=first, v=int(round(values[0]))))
+print("#define BVM_TABLE_SHIFT {k}".format(k=args.shift))
+print("#define BVM_TABLE_SIZE {n}".format(n=len(values)))
+
+value_rows = [values[i:i+number_of_values_per_row] for i in range(0, len(values), number_of_values_per_row)]
+
+print(',\n'.join([
+        ', '.join([
+                str(int(round(value))).rjust(tab_length) for value in value_row
+            ]) for value_row in value_rows
+    ]))
@@ -0,0 +1,80 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+
+#FogDrive (https://github.com/FogDrive/FogDrive)
+#Copyright (C) 2016  Daniel Llin Ferrero
+
+#This program is free software: you can redistribute it and/or modify
+#it under the terms of the GNU General Public License as published by
+#the Free Software Foundation, either version 3 of the License, or
+#(at your option) any later version.
+
+#This program is distributed in the hope that it will be useful,
+#but WITHOUT ANY WARRANTY; without even the implied warranty of
+#MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#GNU General Public License for more details.
+
+#You should have received a copy of the GNU General Public License
+#along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+
+
+
+from __future__ import division, print_function
+import argparse
+
+
+parser = argparse.ArgumentParser(
+    prog='soccurve',
+    usage='%(prog)s [options]\nPrints a C array containing the rested cell voltage in mV for equidistant states of charge (0% to 100%).\n' \
+          'This script is used to create the discharge curves for the state of charge of FogDrive (see battery.c).'
+)
+
+# Open circuit voltage (mV) over the state of charge (%) of typical cells, taken from discharge curves at low
+# currents. Points in between are interpolated linearly. New cell types just need a new entry here.
+curves = {
+    'li-ion': [                     # LiCoO2 / NMC (most 18650 cells), 4.2 V charge voltage
+        (0, 3000), (5, 3300), (10, 3450), (15, 3530), (20, 3580), (25, 3620), (30, 3650), (35, 3680),
+        (40, 3710), (45, 3740), (50, 3770), (55, 3800), (60, 3840), (65, 3880), (70, 3920), (75, 3960),
+        (80, 4000), (85, 4040), (90, 4080), (95, 4130), (100, 4200),
+    ],
+    'imr': [                        # LiMn2O4 (IMR), 4.2 V charge voltage
+        (0, 3100), (5, 3400), (10, 3520), (20, 3620), (30, 3690), (40, 3750), (50, 3800), (60, 3860),
+        (70, 3920), (80, 3990), (90, 4080), (100, 4200),
+    ],
+    'lifepo4': [                    # LiFePO4, 3.6 V charge voltage, very flat in the middle
+        (0, 2800), (5, 3000), (10, 3150), (20, 3220), (30, 3255), (40, 3275), (50, 3290), (60, 3300),
+        (70, 3310), (80, 3330), (90, 3345), (95, 3360), (100, 3450),
+    ],
+}
+
+def interpolate(points, soc):
+    for (soc_a, mv_a), (soc_b, mv_b) in zip(points, points[1:]):
+        if soc_a <= soc <= soc_b:
+            return mv_a + (mv_b - mv_a) * (soc - soc_a) / (soc_b - soc_a)
+    raise ValueError(soc)
+
+parser.add_argument('-c', '--chemistry', required=True, help="The cell type, one of {" + ", ".join(sorted(curves)) + "}")
+parser.add_argument('-n', '--number',    type=int, required=True, help="Number of elements (21 for 5% steps)")
+
+args = parser.parse_args()
+
+assert args.chemistry in curves
+assert args.number > 1 and 100 % (args.number - 1) == 0
+
+points = curves[args.chemistry]
+step = 100 // (args.number - 1)
+values = [interpolate(points, n * step) for n in range(args.number)]
+
+assert all(a < b for a, b in zip(values, values[1:])), "the voltage must rise with the state of charge"
+
+number_of_values_per_row = 8
+tab_length = 5
+
+value_rows = [values[i:i+number_of_values_per_row] for i in range(0, len(values), number_of_values_per_row)]
+
+print(',\n'.join([
+        ', '.join([
+                str(int(round(value))).rjust(tab_length) for value in value_row
+            ]) for value_row in value_rows
+    ]))
@@ -98,6 +98,8 @@ parser.add_argument('-b', '--max',    type=int, required=True, help="Maximum val
 parser.add_argument('-n', '--number', type=int, required=True, help="Number of elements")
 parser.add_argument('-f', '--function', required=True, help="The used function, one of {'simple-quadratic', 'exponential'}")
 parser.add_argument('-p', '--params', help="Function specific extra parameters as 'name:value[,name:value]...'")
+parser.add_argument('-x', '--fraction-bits', type=int, default=0, help="Print the values as fixed point numbers with this number of fractional bits " \
+                                                                       "(e.g. 8 for 16 bit values with a min and max up to 255)")
 
 args = parser.parse_args()
 
@@ -108,7 +110,7 @@ assert args.function in functions
 params = {p.split(':')[0]:p.split(':')[1] for p in args.params.split(',')} if args.params else {}
 
 number_of_values_per_row = 8
-tab_length = 4
+tab_length = 4 if args.fraction_bits == 0 else 6
 
 function_record = functions[args.function]
 
@@ -122,6 +124,7 @@ for parameter_record in function_record[1]:
         sys.exit(1)
 
 values = f(args.min, args.max, args.number, params)
+values = [value * 2**args.fraction_bits for value in values]
 
 value_rows = [values[i:i+number_of_values_per_row] for i in range(0, len(values), number_of_values_per_row)] 
     